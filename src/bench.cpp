@@ -0,0 +1,363 @@
+#include "db.hpp"
+#include <chrono>
+#include <random>
+#include <cmath>
+
+// YCSB core workloads A-F against Table/Transaction through the Scheduler.
+// one JSON object per workload is printed to stdout.
+//
+// usage: ./bench [--workload=ABCDEF] [--records=10000] [--operations=10000]
+//                [--key-size=16] [--value-size=100] [--distribution=zipfian|uniform]
+//                [--concurrency=8] [--ops-per-txn=1] [--cc=s2pl|occ]
+//                [--profile] [--trace=file] [--hot-keys=N] [--bg-writer]
+//
+// --profile prints the per-phase latency histograms of each workload to stderr,
+// --hot-keys the N most contended lock keys, --bg-writer starts the background page writer,
+// --trace writes a Chrome trace-event file (workload letter appended to its name)
+//
+//   A  50% read, 50% update
+//   B  95% read,  5% update
+//   C 100% read
+//   D  95% read of the latest keys, 5% insert
+//   E  95% scan of up to 100 keys, 5% insert
+//   F  50% read, 50% read-modify-write
+
+struct BenchConfig {
+    std::string workloads;
+    long records;
+    long operations;
+    int key_size;
+    int value_size;
+    bool zipfian;
+    int concurrency;
+    int ops_per_txn;
+    ConcurrencyControl concurrency_control;
+    bool profile;
+    std::string trace_file_name;
+    int hot_keys;
+    bool background_writer;
+};
+
+enum struct BenchOpKind {
+    read,
+    update,
+    insert,
+    scan,
+    rmw, // read-modify-write
+};
+
+struct BenchOp {
+    BenchOpKind kind;
+    long key;
+    int scan_len;
+};
+
+struct BenchTxn {
+    std::vector<BenchOp> ops;
+    std::optional<std::chrono::steady_clock::time_point> start; // first run, kept across retries
+    bool committed;
+    double latency_us; // first run to commit, only set when committed
+};
+
+// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record synthetic databases")
+struct Zipfian {
+    long items;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+
+    Zipfian(long items,double theta = 0.99)
+        :items(items),
+         theta(theta) {
+        double zeta2 = zeta(2);
+        zetan = zeta(items);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / items,1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    double zeta(long n) {
+        double sum = 0;
+        for (long i = 0;i < n; i++) {
+            sum += 1 / std::pow(i + 1,theta);
+        }
+        return sum;
+    }
+
+    // 0 is the most popular item
+    long next(std::mt19937_64 &rnd) {
+        double u = std::uniform_real_distribution<double>(0,1)(rnd);
+        double uz = u * zetan;
+        if (uz < 1) return 0;
+        if (uz < 1 + std::pow(0.5,theta)) return 1;
+        return std::min(items - 1,(long)(items * std::pow(eta * u - eta + 1,alpha)));
+    }
+};
+
+// spreads the popular zipfian items over the key space like YCSB's scrambled zipfian
+long fnv_hash(long x) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (int i = 0;i < 8; i++) {
+        hash ^= (x >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return (long)(hash >> 1);
+}
+
+std::string bench_key(long key,int key_size) {
+    std::string digits = std::to_string(key);
+    int width = std::max(key_size - 4,(int)digits.size());
+    return "user" + std::string(width - digits.size(),'0') + digits;
+}
+
+std::string bench_value(long key,int value_size) {
+    std::string value = "v" + std::to_string(key) + "_";
+    value.resize(value_size,'x');
+    return value;
+}
+
+my_task bench_transaction(Table *table,BenchTxn *bench_txn,const BenchConfig *config) {
+    if (!bench_txn->start) {
+        bench_txn->start = std::chrono::steady_clock::now();
+    }
+    Transaction txn(table);
+    co_yield txn.begin();
+    for (const BenchOp &op : bench_txn->ops) {
+        std::string key = bench_key(op.key,config->key_size);
+        switch (op.kind) {
+            case BenchOpKind::read:
+                co_await txn.select(key);
+                break;
+            case BenchOpKind::update:
+                co_await txn.update(key,bench_value(op.key + 1,config->value_size));
+                break;
+            case BenchOpKind::insert:
+                co_await txn.insert(key,bench_value(op.key,config->value_size));
+                break;
+            case BenchOpKind::scan:
+                co_await txn.scan(key,bench_key(op.key + op.scan_len,config->key_size));
+                break;
+            case BenchOpKind::rmw:
+                {
+                    auto value = co_await txn.select(key);
+                    if (value) {
+                        co_await txn.update(key,bench_value(op.key + value->size(),config->value_size));
+                    }
+                }
+                break;
+        }
+    }
+    // the Scheduler destroys the task at the co_yield, measure before it
+    bool commit = txn.commit();
+    if (commit) {
+        auto end = std::chrono::steady_clock::now();
+        bench_txn->committed = true;
+        bench_txn->latency_us = std::chrono::duration<double,std::micro>(end - bench_txn->start.value()).count();
+    }
+    co_yield commit;
+    co_return;
+}
+
+double percentile(const std::vector<double> &sorted,double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = std::min(sorted.size() - 1,(size_t)std::ceil(p * sorted.size()) - (p > 0));
+    return sorted[idx];
+}
+
+void run_workload(char workload,const BenchConfig &config) {
+    std::string btree_file_name = "bench_btree.txt";
+    std::string data_file_name = "bench_data.txt";
+    std::string log_file_name = "bench_log.txt";
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+
+    // operation mix in percent: read, update, insert, scan, rmw
+    int mix[5];
+    switch (workload) {
+        case 'A': mix[0] = 50;  mix[1] = 50; mix[2] = 0; mix[3] = 0;  mix[4] = 0;  break;
+        case 'B': mix[0] = 95;  mix[1] = 5;  mix[2] = 0; mix[3] = 0;  mix[4] = 0;  break;
+        case 'C': mix[0] = 100; mix[1] = 0;  mix[2] = 0; mix[3] = 0;  mix[4] = 0;  break;
+        case 'D': mix[0] = 95;  mix[1] = 0;  mix[2] = 5; mix[3] = 0;  mix[4] = 0;  break;
+        case 'E': mix[0] = 0;   mix[1] = 0;  mix[2] = 5; mix[3] = 95; mix[4] = 0;  break;
+        case 'F': mix[0] = 50;  mix[1] = 0;  mix[2] = 0; mix[3] = 0;  mix[4] = 50; break;
+        default:
+            std::cerr << "unknown workload " << workload << std::endl;
+            return;
+    }
+
+    long commits = 0;
+    double seconds = 0;
+    std::vector<double> latencies;
+    {
+        Table table(btree_file_name,data_file_name,log_file_name,config.concurrency_control);
+        table.profiler.enabled = config.profile || config.trace_file_name != "";
+        if (config.background_writer) {
+            table.btree.buffer_manager.start_writer();
+        }
+        if (config.hot_keys > 0) {
+            table.lock_manager.hot_keys.sample_period = 16;
+        }
+        for (long i = 0;i < config.records; i++) {
+            table.btree.insert(bench_key(i,config.key_size),bench_value(i,config.value_size));
+        }
+
+        std::mt19937_64 rnd(0);
+        std::uniform_int_distribution<int> percent(0,99);
+        std::uniform_int_distribution<long> uniform(0,config.records - 1);
+        std::uniform_int_distribution<int> scan_len(1,100);
+        Zipfian zipfian(config.records);
+        long inserted = config.records;
+        auto next_key = [&]() -> long {
+            if (workload == 'D') {
+                // latest: the most recently inserted keys are the most popular
+                return inserted - 1 - std::min(inserted - 1,zipfian.next(rnd));
+            } else if (config.zipfian) {
+                return fnv_hash(zipfian.next(rnd)) % inserted;
+            } else {
+                return uniform(rnd) % inserted;
+            }
+        };
+
+        long txns = (config.operations + config.ops_per_txn - 1) / config.ops_per_txn;
+        std::vector<BenchTxn> bench_txns(txns);
+        long op_count = 0;
+        for (BenchTxn &bench_txn : bench_txns) {
+            for (int i = 0;i < config.ops_per_txn && op_count < config.operations; i++,op_count++) {
+                int r = percent(rnd);
+                int kind = 0;
+                while (r >= mix[kind]) {
+                    r -= mix[kind];
+                    ++kind;
+                }
+                BenchOp op{static_cast<BenchOpKind>(kind),0,0};
+                if (op.kind == BenchOpKind::insert) {
+                    op.key = inserted++;
+                } else {
+                    op.key = next_key();
+                }
+                if (op.kind == BenchOpKind::scan) {
+                    op.scan_len = scan_len(rnd);
+                }
+                bench_txn.ops.push_back(op);
+            }
+        }
+
+        // closed loop: concurrency transactions are in flight, the slot of a finished one
+        // starts the next right away. aborted ones are retried
+        table.scheduler.max_retries = 100;
+        long next_txn = 0;
+        auto next_task = [&]() -> task_factory {
+            if (next_txn == txns) {
+                return task_factory();
+            }
+            BenchTxn *bench_txn = &bench_txns[next_txn++];
+            return [&table,bench_txn,&config]{ return bench_transaction(&table,bench_txn,&config); };
+        };
+        if (config.trace_file_name != "") {
+            table.profiler.start_trace(config.trace_file_name + "." + workload);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int slot = 0;slot < config.concurrency && next_txn < txns; slot++) {
+            table.add_transaction(next_task());
+        }
+        table.scheduler.next_task = next_task;
+        table.exec_transaction();
+        table.scheduler.next_task = nullptr;
+        auto end = std::chrono::steady_clock::now();
+        seconds = std::chrono::duration<double>(end - start).count();
+        // a transaction that gave up has no latency, it is counted in aborts
+        for (BenchTxn &bench_txn : bench_txns) {
+            if (bench_txn.committed) {
+                ++commits;
+                latencies.push_back(bench_txn.latency_us);
+            }
+        }
+        std::sort(latencies.begin(),latencies.end());
+        table.profiler.stop_trace();
+        if (config.profile) {
+            std::cerr << "workload " << workload << std::endl;
+            table.profiler.report(std::cerr);
+        }
+        if (config.hot_keys > 0) {
+            std::cerr << "workload " << workload << " hot keys" << std::endl;
+            table.lock_manager.hot_keys.report(std::cerr,config.hot_keys);
+        }
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << "{\"workload\":\"" << workload << "\""
+                  << ",\"cc\":\"" << (config.concurrency_control == ConcurrencyControl::OCC ? "occ" : "s2pl") << "\""
+                  << ",\"distribution\":\"" << (workload == 'D' ? "latest" : config.zipfian ? "zipfian" : "uniform") << "\""
+                  << ",\"records\":" << config.records
+                  << ",\"operations\":" << config.operations
+                  << ",\"transactions\":" << txns
+                  << ",\"commits\":" << commits
+                  << ",\"aborts\":" << txns - commits
+                  << ",\"retries\":" << table.scheduler.retry_count
+                  << ",\"evictions\":" << table.stats().buffer.evictions
+                  << ",\"dirty_evictions\":" << table.stats().buffer.dirty_writebacks
+                  << ",\"concurrency\":" << config.concurrency
+                  << ",\"key_size\":" << config.key_size
+                  << ",\"value_size\":" << config.value_size
+                  << std::setprecision(3)
+                  << ",\"seconds\":" << seconds
+                  << std::setprecision(1)
+                  << ",\"ops_per_sec\":" << config.operations / seconds
+                  << ",\"latency_us\":{\"p50\":" << percentile(latencies,0.5)
+                  << ",\"p99\":" << percentile(latencies,0.99)
+                  << ",\"p999\":" << percentile(latencies,0.999) << "}}" << std::endl;
+    }
+
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+}
+
+int main(int argc,char *argv[]) {
+    BenchConfig config{"ABCDEF",10000,10000,16,100,true,8,1,ConcurrencyControl::S2PL,false,"",0,false};
+    for (int i = 1;i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0,eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--workload") {
+            config.workloads = value;
+        } else if (name == "--records") {
+            config.records = atol(value.c_str());
+        } else if (name == "--operations") {
+            config.operations = atol(value.c_str());
+        } else if (name == "--key-size") {
+            config.key_size = atoi(value.c_str());
+        } else if (name == "--value-size") {
+            config.value_size = atoi(value.c_str());
+        } else if (name == "--distribution") {
+            config.zipfian = value != "uniform";
+        } else if (name == "--concurrency") {
+            config.concurrency = atoi(value.c_str());
+        } else if (name == "--ops-per-txn") {
+            config.ops_per_txn = atoi(value.c_str());
+        } else if (name == "--cc") {
+            config.concurrency_control = value == "occ" ? ConcurrencyControl::OCC : ConcurrencyControl::S2PL;
+        } else if (name == "--profile") {
+            config.profile = true;
+        } else if (name == "--trace") {
+            config.trace_file_name = value;
+        } else if (name == "--bg-writer") {
+            config.background_writer = true;
+        } else if (name == "--hot-keys") {
+            config.hot_keys = atoi(value.c_str());
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    // key.size() <= 392, value.size() <= 392
+    assert(0 < config.key_size && config.key_size <= 392);
+    assert(0 < config.value_size && config.value_size <= 392);
+    assert(config.records > 0 && config.operations > 0 && config.concurrency > 0 && config.ops_per_txn > 0);
+
+    for (char workload : config.workloads) {
+        run_workload(workload,config);
+    }
+    return 0;
+}
@@ -1,72 +1,112 @@
 #include "db.hpp"
 
-BTree::BTree(const std::string &file_name)
-    :buffer_manager(BufferManager(file_name)) 
+BTree::BTree(const std::string &file_name,ReplacementPolicy policy)
+    :buffer_manager(file_name,policy),
+     superblock(&buffer_manager),
+     root(nullptr),
+     valid(true)
 {
     if (buffer_manager.disk_manager.page_num == 0) {
-        buffer_manager.create_new_page();
-        root = new Node(&buffer_manager,0);
-        root->set_keys_size(0);
-        root->set_is_leaf(true);
+        init();
+    } else if (!superblock.validate()) {
+        valid = false;
+        clear();
     } else {
-        root = new Node(&buffer_manager,0);
+        root = new Node(&buffer_manager,superblock.root_pageid());
+        buffer_manager.free_list_head = superblock.free_list_head();
     }
 }
 
+// create the superblock and an empty leaf as root
+void BTree::init(void) {
+    int pageid = buffer_manager.create_new_page();
+    assert(pageid == superblock_pageid);
+    superblock.format();
+    root = new Node(&buffer_manager,buffer_manager.allocate_page());
+    root->set_keys_size(0);
+    root->set_is_leaf(true);
+    set_root(root->pageid);
+}
+
+void BTree::set_root(int pageid) {
+    superblock.set_root_pageid(pageid);
+    root->pageid = pageid;
+}
+
+void BTree::set_checkpoint_lsn(unsigned long long lsn) {
+    superblock.set_checkpoint_lsn(lsn);
+}
+
 BTree::~BTree() {
     if(root != nullptr) delete root;
-    buffer_manager.flush();
+    flush();
 }
 
-std::optional<std::string> BTree::search(const std::string &key) {
+std::optional<std::string> BTree::search(std::string_view key) {
     return root->search(key);
 }    
 
-bool BTree::update(const std::string &key,const std::string &value) {
+bool BTree::update(std::string_view key,const std::string &value) {
     return root->update(key,value);
 }
 
-void BTree::insert(const std::string &key,const std::string &value) {
-    if (root->isfull()) {
-        int temp_pageid = buffer_manager.create_new_page();
-        Node temp = Node(&buffer_manager,temp_pageid);
-        const char *root_page_buf = buffer_manager.read_page(root->pageid,checksum_len,PAGESIZE - checksum_len);
-        buffer_manager.write_page(temp.pageid,root_page_buf,checksum_len,PAGESIZE - checksum_len);
-        free(const_cast<char*>(root_page_buf));
-        root->set_is_leaf(false);
-        root->set_keys_size(0);
-        root->set_child_pageid(0,temp.pageid);
-        root->splitchild(0);
+void BTree::insert(std::string_view key,std::string_view value) {
+    auto old_value = upsert(key,value);
+    assert(!old_value);
+    (void)old_value;
+}
+
+std::optional<std::string> BTree::upsert(std::string_view key,std::string_view value) {
+    NodeImage image = root->load();
+    if (image.isfull()) {
+        // the tree grows at the top: a new root points at the old one
+        int old_root_pageid = root->pageid;
+        Node new_root(&buffer_manager,buffer_manager.allocate_page());
+        new_root.set_is_leaf(false);
+        new_root.set_keys_size(0);
+        new_root.set_child_pageid(0,old_root_pageid);
+        set_root(new_root.pageid);
+        image = NodeImage{false,0,{old_root_pageid},{},{}};
     }
-    root->insert(key,value);
+    return root->upsert(key,value,std::move(image));
+}
+
+bool BTree::del(std::string_view key) {
+    return erase(key).has_value();
 }
 
-bool BTree::del(const std::string &key) {
-    bool success_del = root->del(key);
+std::optional<std::string> BTree::erase(std::string_view key) {
+    auto old_value = root->erase(key);
     if (root->keys_size() == 0 && !root->is_leaf()) {
-        int pageid = root->child_pageid(0);
-        const char *page_buf = buffer_manager.read_page(pageid,checksum_len,PAGESIZE - checksum_len);
-        buffer_manager.write_page(root->pageid,page_buf,checksum_len,PAGESIZE - checksum_len);
-        free(const_cast<char*>(page_buf));
-        // we don't use pageid's page from now on
+        // the tree shrinks at the top: the only child becomes the root
+        int old_root_pageid = root->pageid;
+        set_root(root->child_pageid(0));
+        buffer_manager.free_page(old_root_pageid);
     }
-    return success_del;
+    return old_value;
 }
 
 void BTree::clear(void) {
     delete root;
-    buffer_manager.flush();
+    buffer_manager.discard();
     buffer_manager.disk_manager.clear_file();
-    buffer_manager.create_new_page();
-    root = new Node(&buffer_manager,0);
-    root->set_keys_size(0);
-    root->set_is_leaf(true);
+    buffer_manager.free_list_head = -1;
+    init();
 }
 
 void BTree::flush(void) {
+    superblock.set_free_list_head(buffer_manager.free_list_head);
     buffer_manager.flush();
 }
 
+std::map<std::string,std::string> BTree::range(const std::string &low,const std::string &high) {
+    std::map<std::string,std::string> datas;
+    if (low < high) {
+        root->range(low,high,datas);
+    }
+    return datas;
+}
+
 std::map<std::string,std::string> BTree::all_data(void) {
     return root->all_data();
 }
@@ -0,0 +1,218 @@
+#include "db.hpp"
+#include <random>
+
+// hit ratio of each replacement policy on point lookups into a hot set of
+// pages, interleaved with sequential scans over the other, cold pages.
+// one JSON object per policy and scan length is printed to stdout.
+// then the same through a real BTree: BTree::search on a hot set of keys,
+// interleaved with BTree::all_data, one JSON object per policy.
+//
+// usage: ./buffer_bench [--policy=clock,2q,arc] [--pages=4000] [--hot-pages=500]
+//                       [--lookups=200000] [--scan-every=10000] [--scan-pages=500,1000,2000,3500]
+//                       [--btree-keys=20000] [--hot-keys=200] [--btree-lookups=100000]
+//                       [--btree-scan-every=20000]
+//
+// --btree-keys=0 skips the BTree run
+
+struct BufferBenchConfig {
+    std::vector<std::string> policies;
+    int pages;
+    int hot_pages;
+    long lookups;
+    long scan_every;
+    std::vector<int> scan_pages;
+    int btree_keys;
+    int hot_keys;
+    long btree_lookups;
+    long btree_scan_every;
+};
+
+std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> items;
+    std::stringstream stream(s);
+    std::string item;
+    while (getline(stream,item,',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+std::optional<ReplacementPolicy> parse_policy(const std::string &policy_name) {
+    if (policy_name == "clock") {
+        return ReplacementPolicy::Clock;
+    } else if (policy_name == "2q") {
+        return ReplacementPolicy::TwoQ;
+    } else if (policy_name == "arc") {
+        return ReplacementPolicy::ARC;
+    }
+    std::cerr << "unknown policy " << policy_name << std::endl;
+    return std::nullopt;
+}
+
+std::string bench_key(int i) {
+    std::string number = std::to_string(i);
+    return "key" + std::string(8 - std::min<size_t>(8,number.size()),'0') + number;
+}
+
+void run_policy(const std::string &policy_name,int scan_pages,const BufferBenchConfig &config,const std::string &file_name) {
+    std::optional<ReplacementPolicy> policy = parse_policy(policy_name);
+    if (!policy) {
+        return;
+    }
+
+    BufferManager buffer_manager(file_name,policy.value());
+    std::mt19937_64 rnd(0);
+    std::uniform_int_distribution<int> hot(0,config.hot_pages - 1);
+    auto touch = [&](int pageid) {
+        free(const_cast<char*>(buffer_manager.read_page(pageid,checksum_len,8)));
+    };
+
+    unsigned long long lookup_hits = 0;
+    int scan_start = 0;
+    for (long i = 0;i < config.lookups; i++) {
+        if (i % config.scan_every == 0 && i > 0) {
+            // the scans walk the cold pages after the hot set
+            int cold_pages = config.pages - config.hot_pages;
+            for (int j = 0;j < scan_pages; j++) {
+                touch(config.hot_pages + (scan_start + j) % cold_pages);
+            }
+            scan_start = (scan_start + scan_pages) % cold_pages;
+        }
+        unsigned long long hits = buffer_manager.stats.hits;
+        touch(hot(rnd));
+        lookup_hits += buffer_manager.stats.hits - hits;
+    }
+
+    BufferStats &stats = buffer_manager.stats;
+    std::cout << std::fixed << std::setprecision(4)
+              << "{\"policy\":\"" << policy_name << "\""
+              << ",\"frames\":" << MAX_BUFFER_SIZE
+              << ",\"pages\":" << config.pages
+              << ",\"hot_pages\":" << config.hot_pages
+              << ",\"lookups\":" << config.lookups
+              << ",\"scan_every\":" << config.scan_every
+              << ",\"scan_pages\":" << scan_pages
+              << ",\"lookup_hit_ratio\":" << (double)lookup_hits / config.lookups
+              << ",\"hit_ratio\":" << (double)stats.hits / (stats.hits + stats.misses)
+              << ",\"evictions\":" << stats.evictions << "}" << std::endl;
+}
+
+// every node on a search path is read field by field, so this also shows
+// how the policies count the repeated reads of one node
+void run_btree_policy(const std::string &policy_name,const BufferBenchConfig &config,const std::string &btree_file_name) {
+    std::optional<ReplacementPolicy> policy = parse_policy(policy_name);
+    if (!policy) {
+        return;
+    }
+
+    BTree btree(btree_file_name,policy.value());
+    BufferManager &buffer_manager = btree.buffer_manager;
+    std::mt19937_64 rnd(0);
+    std::uniform_int_distribution<int> hot(0,config.hot_keys - 1);
+    // the hot keys are spread over the whole key range, one leaf each
+    int stride = config.btree_keys / config.hot_keys;
+
+    unsigned long long lookup_hits = 0;
+    unsigned long long lookup_accesses = 0;
+    int scans = 0;
+    for (long i = 0;i < config.btree_lookups; i++) {
+        if (i % config.btree_scan_every == 0 && i > 0) {
+            assert((int)btree.all_data().size() == config.btree_keys);
+            ++scans;
+        }
+        unsigned long long hits = buffer_manager.stats.hits;
+        unsigned long long misses = buffer_manager.stats.misses;
+        auto value = btree.search(bench_key(hot(rnd) * stride));
+        assert(value);
+        (void)value;
+        lookup_hits += buffer_manager.stats.hits - hits;
+        lookup_accesses += buffer_manager.stats.hits - hits + buffer_manager.stats.misses - misses;
+    }
+
+    BufferStats &stats = buffer_manager.stats;
+    std::cout << std::fixed << std::setprecision(4)
+              << "{\"workload\":\"btree\",\"policy\":\"" << policy_name << "\""
+              << ",\"frames\":" << MAX_BUFFER_SIZE
+              << ",\"pages\":" << buffer_manager.disk_manager.page_num
+              << ",\"keys\":" << config.btree_keys
+              << ",\"hot_keys\":" << config.hot_keys
+              << ",\"lookups\":" << config.btree_lookups
+              << ",\"scans\":" << scans
+              << ",\"lookup_hit_ratio\":" << (double)lookup_hits / lookup_accesses
+              << ",\"misses_per_lookup\":" << (double)(lookup_accesses - lookup_hits) / config.btree_lookups
+              << ",\"hit_ratio\":" << (double)stats.hits / (stats.hits + stats.misses)
+              << ",\"evictions\":" << stats.evictions << "}" << std::endl;
+}
+
+int main(int argc,char *argv[]) {
+    BufferBenchConfig config{{"clock","2q","arc"},4000,500,200000,10000,{500,1000,2000,3500},20000,200,100000,20000};
+    for (int i = 1;i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0,eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--policy") {
+            config.policies = split(value);
+        } else if (name == "--pages") {
+            config.pages = atoi(value.c_str());
+        } else if (name == "--hot-pages") {
+            config.hot_pages = atoi(value.c_str());
+        } else if (name == "--lookups") {
+            config.lookups = atol(value.c_str());
+        } else if (name == "--scan-every") {
+            config.scan_every = atol(value.c_str());
+        } else if (name == "--scan-pages") {
+            config.scan_pages.clear();
+            for (auto &scan_pages : split(value)) {
+                config.scan_pages.push_back(atoi(scan_pages.c_str()));
+            }
+        } else if (name == "--btree-keys") {
+            config.btree_keys = atoi(value.c_str());
+        } else if (name == "--hot-keys") {
+            config.hot_keys = atoi(value.c_str());
+        } else if (name == "--btree-lookups") {
+            config.btree_lookups = atol(value.c_str());
+        } else if (name == "--btree-scan-every") {
+            config.btree_scan_every = atol(value.c_str());
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    assert(0 < config.hot_pages && config.hot_pages < config.pages);
+    assert(config.lookups > 0 && config.scan_every > 0);
+    assert(config.btree_keys == 0 || (0 < config.hot_keys && config.hot_keys <= config.btree_keys));
+    assert(config.btree_lookups > 0 && config.btree_scan_every > 0);
+
+    std::string file_name = "buffer_bench.txt";
+    remove(file_name.c_str());
+    {
+        BufferManager buffer_manager(file_name);
+        for (int i = 0;i < config.pages; i++) {
+            buffer_manager.create_new_page();
+        }
+    }
+    for (int scan_pages : config.scan_pages) {
+        for (auto &policy : config.policies) {
+            run_policy(policy,scan_pages,config,file_name);
+        }
+    }
+    remove(file_name.c_str());
+
+    if (config.btree_keys > 0) {
+        std::string btree_file_name = "buffer_bench_btree.txt";
+        remove(btree_file_name.c_str());
+        {
+            BTree btree(btree_file_name);
+            std::string value(100,'v');
+            for (int i = 0;i < config.btree_keys; i++) {
+                btree.insert(bench_key(i),value);
+            }
+        }
+        for (auto &policy : config.policies) {
+            run_btree_policy(policy,config,btree_file_name);
+        }
+        remove(btree_file_name.c_str());
+    }
+    return 0;
+}
@@ -2,78 +2,440 @@
 
 const int MAX_BUFFER_SIZE = 1000;
 
-BufferManager::BufferManager(const std::string &file_name)
-    :disk_manager(DiskManager(file_name)),
+BufferManager::BufferManager(const std::string &file_name,ReplacementPolicy policy)
+    :disk_manager(file_name),
      pages(),
      pagetable(),
-     victim_index_base(0) 
+     victim_index_base(0),
+     free_list_head(-1),
+     stats({0,0,0,0,0,0,0,0,0,0}),
+     policy(policy),
+     two_queue(MAX_BUFFER_SIZE),
+     adaptive_cache(MAX_BUFFER_SIZE),
+     last_reference(-1),
+     writer_stop(false),
+     dirty_ratio(WRITER_DIRTY_RATIO),
+     writer_interval(WRITER_INTERVAL_MS),
+     writes_in_flight(0),
+     readahead_pages(READAHEAD_PAGES),
+     last_miss(-1),
+     sequential_misses(0)
 {
         pages.resize(MAX_BUFFER_SIZE);
 }
 
 BufferManager::~BufferManager() {
+    stop_writer();
     flush();
 }
 
-void BufferManager::fetch_page(int pageid) {
-    if (pagetable.count(pageid) > 0) {
+// the latch is needed only while the writer thread runs,
+// the database itself runs on one thread
+std::unique_lock<std::mutex> BufferManager::latch_guard(void) {
+    if (writer.joinable()) {
+        return std::unique_lock<std::mutex>(latch);
+    }
+    return std::unique_lock<std::mutex>(latch,std::defer_lock);
+}
+
+void BufferManager::start_writer(double dirty_ratio_,std::chrono::milliseconds interval) {
+    assert(!writer.joinable());
+    dirty_ratio = dirty_ratio_;
+    writer_interval = interval;
+    writer_stop = false;
+    writer = std::thread([this]{ writer_loop(); });
+}
+
+void BufferManager::stop_writer(void) {
+    if (!writer.joinable()) {
         return;
     }
+    {
+        std::lock_guard<std::mutex> guard(latch);
+        writer_stop = true;
+    }
+    writer_cv.notify_all();
+    writer.join();
+}
+
+void BufferManager::writer_loop(void) {
+    std::unique_lock<std::mutex> guard(latch);
+    while (!writer_stop) {
+        writer_cv.wait_for(guard,writer_interval);
+        if (!writer_stop) {
+            clean(guard);
+        }
+    }
+}
+
+// write back dirty frames until at most dirty_ratio of the pool is dirty.
+// frames are copied under the latch, checksummed and written without it;
+// a frame modified meanwhile simply stays dirty.
+void BufferManager::clean(std::unique_lock<std::mutex> &guard) {
+    int excess = dirty_frames() - (int)(dirty_ratio * pages.size());
+    if (excess <= 0) {
+        return;
+    }
+    // in the order the replacement policy will evict them
+    std::vector<int> indexes;
+    auto candidate = [&](int index) {
+        Page &page = pages[index];
+        if (page.dirty && !page.writing && page.pin_count == 0) {
+            indexes.push_back(index);
+        }
+        return (int)indexes.size() < excess;
+    };
+    auto lru_first = [&](const LruList &list) {
+        for (auto it = list.order.rbegin(); it != list.order.rend(); ++it) {
+            if (!candidate(pagetable[*it])) {
+                return false;
+            }
+        }
+        return true;
+    };
+    switch (policy) {
+        case ReplacementPolicy::Clock:
+            for (int i = 0;i < (int)pages.size(); i++) {
+                int index = (victim_index_base + i) % pages.size();
+                // a frame not in pagetable holds no page
+                auto it = pagetable.find(pages[index].pageid);
+                if (it == pagetable.end() || it->second != index) {
+                    continue;
+                }
+                if (!candidate(index)) {
+                    break;
+                }
+            }
+            break;
+        case ReplacementPolicy::TwoQ:
+            lru_first(two_queue.a1in) && lru_first(two_queue.am);
+            break;
+        case ReplacementPolicy::ARC:
+            lru_first(adaptive_cache.t1) && lru_first(adaptive_cache.t2);
+            break;
+    }
+    std::vector<char> copies(indexes.size() * PAGESIZE);
+    std::vector<int> pageids;
+    for (size_t i = 0;i < indexes.size(); i++) {
+        Page &page = pages[indexes[i]];
+        std::copy(page.page,page.page + PAGESIZE,copies.data() + i * PAGESIZE);
+        pageids.push_back(page.pageid);
+        page.dirty = false;
+        page.writing = true;
+    }
+    writes_in_flight += indexes.size();
+
+    guard.unlock();
+    std::vector<double> latencies;
+    for (size_t i = 0;i < indexes.size(); i++) {
+        char *copy = copies.data() + i * PAGESIZE;
+        auto start = std::chrono::steady_clock::now();
+        unsigned int checksum = crc32(copy + checksum_len,PAGESIZE - checksum_len);
+        std::string checksum_str = to_hex(checksum);
+        std::copy(checksum_str.begin(),checksum_str.end(),copy);
+        disk_manager.write(pageids[i],copy);
+        latencies.push_back(elapsed_us(start));
+    }
+    guard.lock();
+
+    for (size_t i = 0;i < indexes.size(); i++) {
+        Page &page = pages[indexes[i]];
+        page.writing = false;
+        if (!page.dirty) {
+            // the frame matches the disk, give it the checksum written
+            std::copy(copies.data() + i * PAGESIZE,copies.data() + i * PAGESIZE + checksum_len,page.page);
+        }
+        disk_manager.io_stats.add_write(PAGESIZE,latencies[i]);
+        ++stats.background_writes;
+    }
+    writes_in_flight -= indexes.size();
+    writer_cv.notify_all();
+}
+
+// frames in pagetable that differ from the disk
+int BufferManager::dirty_frames(void) {
+    int dirty = 0;
+    for (auto [pageid,page_index] : pagetable) {
+        dirty += pages[page_index].dirty;
+        (void)pageid;
+    }
+    return dirty;
+}
+
+// index of the frame holding pageid, read from disk on a miss
+int BufferManager::frame(int pageid,std::unique_lock<std::mutex> &guard) {
+    // Node reads its page one field at a time. a run of calls for the same
+    // page is one reference, like 2Q's correlated references
+    bool correlated = pageid == last_reference;
+    last_reference = pageid;
+    auto it = pagetable.find(pageid);
+    if (it != pagetable.end()) {
+        ++stats.hits;
+        if (pages[it->second].prefetched) {
+            // the first access is the one the page was admitted for, it
+            // does not make a scanned page frequent for TwoQ or ARC
+            pages[it->second].prefetched = false;
+            ++stats.readahead_hits;
+            return it->second;
+        }
+        if (correlated) {
+            return it->second;
+        }
+        if (policy == ReplacementPolicy::TwoQ) {
+            two_queue.hit(pageid);
+        } else if (policy == ReplacementPolicy::ARC) {
+            adaptive_cache.hit(pageid);
+        }
+        return it->second;
+    }
+    ++stats.misses;
+    if (policy == ReplacementPolicy::ARC) {
+        adaptive_cache.miss(pageid);
+    }
+    sequential_misses = pageid == last_miss + 1 ? sequential_misses + 1 : 1;
+    last_miss = pageid;
+    if (readahead_pages > 0 && sequential_misses >= READAHEAD_TRIGGER) {
+        int count = prefetch(pageid,readahead_pages,guard);
+        if (count > 1) {
+            // the miss right after the extent continues the run
+            last_miss = pageid + count - 1;
+            return pagetable[pageid];
+        }
+    }
+    return install(disk_manager.fetch_page(pageid),guard);
+}
+
+// a frame for a page read from disk
+int BufferManager::install(const Page &page,std::unique_lock<std::mutex> &guard) {
+    int page_index;
     if (pagetable.size() >= MAX_BUFFER_SIZE) {
-        int page_index = evict();
-        pages[page_index] = disk_manager.fetch_page(pageid);
-        pagetable[pageid] = page_index;
+        page_index = evict(page.pageid,guard);
     } else {
-        int page_index = pagetable.size();
-        pages[page_index] = disk_manager.fetch_page(pageid);
-        pagetable[pageid] = page_index;
+        page_index = pagetable.size();
+    }
+    pages[page_index] = page;
+    pagetable[page.pageid] = page_index;
+    if (policy == ReplacementPolicy::TwoQ) {
+        two_queue.admit(page.pageid);
+    } else if (policy == ReplacementPolicy::ARC) {
+        adaptive_cache.admit(page.pageid);
     }
+    return page_index;
+}
+
+// read first and the pages after it up to the first cached one in one I/O.
+// at most a quarter of the pool is read ahead at once. returns the pages read
+int BufferManager::prefetch(int first,int count,std::unique_lock<std::mutex> &guard) {
+    count = std::min({count,disk_manager.page_num - first,(int)pages.size() / 4});
+    auto next_cached = pagetable.lower_bound(first);
+    if (next_cached != pagetable.end()) {
+        count = std::min(count,next_cached->first - first);
+    }
+    if (count <= 1) {
+        return count;
+    }
+    std::vector<char> buf((size_t)count * PAGESIZE);
+    disk_manager.fetch_pages(first,count,buf.data());
+    ++stats.readahead_ios;
+    // the page asked for is not a read-ahead. it stays pinned while the
+    // others go in so that they cannot evict it
+    int page_index = install(Page(first,buf.data()),guard);
+    ++pages[page_index].pin_count;
+    for (int i = 1;i < count; i++) {
+        Page page(first + i,buf.data() + (size_t)i * PAGESIZE);
+        page.prefetched = true;
+        ++stats.readahead_pages;
+        install(page,guard);
+    }
+    --pages[page_index].pin_count;
+    return count;
+}
+
+// scan hint: pageids will be read soon. runs of consecutive missing
+// pageids are read in one I/O each
+void BufferManager::read_ahead(std::vector<int> pageids) {
+    if (readahead_pages == 0) {
+        return;
+    }
+    auto guard = latch_guard();
+    std::sort(pageids.begin(),pageids.end());
+    int budget = pages.size() / 4;
+    for (size_t i = 0;i < pageids.size() && budget > 0; ) {
+        if (pagetable.count(pageids[i]) > 0) {
+            ++i;
+            continue;
+        }
+        size_t j = i + 1;
+        while (j < pageids.size() && pageids[j] == pageids[j - 1] + 1 && pagetable.count(pageids[j]) == 0) {
+            ++j;
+        }
+        // a lone page is read when it is used, reading it now saves no I/O
+        int count = std::min({(int)(j - i),budget,readahead_pages});
+        if (count > 1 && (count = prefetch(pageids[i],count,guard)) > 1) {
+            // prefetch counts the first page as asked for, here it is read ahead too
+            pages[pagetable[pageids[i]]].prefetched = true;
+            ++stats.readahead_pages;
+            budget -= count;
+        }
+        i += std::max(count,1);
+    }
+}
+
+void BufferManager::fetch_page(int pageid) {
+    auto guard = latch_guard();
+    frame(pageid,guard);
 }
 
 int BufferManager::create_new_page(void) {
+    auto guard = latch_guard();
     return disk_manager.allocate_new_page();
 }
 
+// free page
+// checksum next_free_pageid
+// | 8     | | 8             |
+int BufferManager::allocate_page(void) {
+    if (free_list_head == -1) {
+        return create_new_page();
+    }
+    int pageid = free_list_head;
+    const char *buf = read_page(pageid,checksum_len,8);
+    free_list_head = strtoul(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return pageid;
+}
+
+void BufferManager::free_page(int pageid) {
+    std::string next_str = to_hex(free_list_head);
+    write_page(pageid,next_str.c_str(),checksum_len,8);
+    free_list_head = pageid;
+}
+
+bool BufferManager::confirm_checksum(int pageid) {
+    auto guard = latch_guard();
+    return pages[frame(pageid,guard)].confirm_checksum();
+}
+
 const char *BufferManager::read_page(int pageid,int offset,int len) {
-    fetch_page(pageid);
-    assert(pagetable.count(pageid) > 0);
-    int page_index = pagetable[pageid];
-    return pages[page_index].read(offset,len);
+    auto guard = latch_guard();
+    return pages[frame(pageid,guard)].read(offset,len);
 }
 
 void BufferManager::write_page(int pageid,const char buf[],int offset,int len) {
-    fetch_page(pageid);
-    assert(pagetable.count(pageid) > 0);
-    int page_index = pagetable[pageid];
-    pages[page_index].write(buf,offset,len);
+    auto guard = latch_guard();
+    pages[frame(pageid,guard)].write(buf,offset,len);
+}
+
+// the latch is held. a clean frame already matches the disk
+void BufferManager::write_back(int page_index) {
+    Page &page = pages[page_index];
+    assert(!page.writing);
+    if (page.dirty) {
+        page.update_checksum();
+        disk_manager.write_page(page.pageid,page);
+    }
 }
 
 void BufferManager::evict_page(int pageid) {
     assert(pagetable.count(pageid) > 0);
-    int index = pagetable[pageid];
-    pages[index].update_checksum();
-    disk_manager.write_page(pageid,pages[index]);
+    write_back(pagetable[pageid]);
     pagetable.erase(pageid);
 }
 
 void BufferManager::flush(void) {
-    for(auto [pageid,_] : pagetable) {
-        evict_page(pageid);
-        (void)_;
+    flush_range(0,std::numeric_limits<int>::max());
+}
+
+// write back the dirty frames of first <= pageid < last and sync the file.
+// pagetable is ordered by pageid, so the writes go out sequentially,
+// and the frames stay cached, clean
+void BufferManager::flush_range(int first,int last) {
+    auto guard = latch_guard();
+    // the writer's copies are older than the frames, let them land first
+    writer_cv.wait(guard,[this]{ return writes_in_flight == 0; });
+    for (auto it = pagetable.lower_bound(first); it != pagetable.end() && it->first < last; ++it) {
+        write_back(it->second);
     }
     disk_manager.flush();
 }
 
-int BufferManager::evict(void) {
-    for(int i = 0;i < 2 * (int)pages.size(); i++) {
-        int victim_index = (victim_index_base + i) % pages.size();
-        if (pages[victim_index].access == 0 && pages[victim_index].pin_count == 0) {
-            evict_page(pages[victim_index].pageid);
-            victim_index_base = (victim_index + 1) % pages.size();
+// forget every frame without writing it, the file is about to be truncated
+void BufferManager::discard(void) {
+    auto guard = latch_guard();
+    writer_cv.wait(guard,[this]{ return writes_in_flight == 0; });
+    // the writer must not write a forgotten frame over the new file
+    for (Page &page : pages) {
+        page.pageid = -1;
+        page.dirty = false;
+        page.prefetched = false;
+        page.access = 0;
+    }
+    pagetable.clear();
+    last_reference = -1;
+    two_queue.clear();
+    adaptive_cache.clear();
+}
+
+// a frame for pageid
+int BufferManager::evict(int pageid,std::unique_lock<std::mutex> &guard) {
+    while (policy != ReplacementPolicy::Clock) {
+        int victim_pageid = victim(pageid);
+        if (victim_pageid != -1) {
+            int victim_index = pagetable[victim_pageid];
+            ++stats.evictions;
+            stats.dirty_writebacks += pages[victim_index].dirty;
+            evict_page(victim_pageid);
             return victim_index;
         }
-        pages[victim_index].access = 0;
+        // every frame is pinned or being written
+        assert(writes_in_flight > 0);
+        writer_cv.wait(guard);
+    }
+    while (true) {
+        for(int i = 0;i < 2 * (int)pages.size(); i++) {
+            int victim_index = (victim_index_base + i) % pages.size();
+            Page &victim = pages[victim_index];
+            if (victim.access == 0 && victim.pin_count == 0 && !victim.writing) {
+                ++stats.evictions;
+                stats.dirty_writebacks += victim.dirty;
+                stats.sweep_steps += i + 1;
+                stats.max_sweep = std::max(stats.max_sweep,(unsigned long long)i + 1);
+                evict_page(victim.pageid);
+                victim_index_base = (victim_index + 1) % pages.size();
+                return victim_index;
+            }
+            victim.access = 0;
+        }
+        // we cannot evict page
+        assert(writes_in_flight > 0);
+        writer_cv.wait(guard);
+    }
+}
+
+// the page chosen by TwoQ or ARC, -1 if no frame can be evicted now
+int BufferManager::victim(int pageid) {
+    switch (policy) {
+        case ReplacementPolicy::TwoQ:
+            return two_queue.victim(*this);
+        case ReplacementPolicy::ARC:
+            return adaptive_cache.victim(pageid,*this);
+        default:
+            assert(false);
+            return -1;
+    }
+}
+
+bool BufferManager::evictable(int pageid) {
+    Page &page = pages[pagetable[pageid]];
+    return page.pin_count == 0 && !page.writing;
+}
+
+int BufferManager::pinned_frames(void) {
+    auto guard = latch_guard();
+    int pinned = 0;
+    for (auto [pageid,page_index] : pagetable) {
+        pinned += pages[page_index].pin_count > 0;
+        (void)pageid;
     }
-    // we cannot evict page
-    assert(false);
-}
\ No newline at end of file
+    return pinned;
+}
@@ -0,0 +1,97 @@
+#include "db.hpp"
+#include <chrono>
+#include <random>
+
+// S2PL (wait-die, wound-wait, deadlock detection) vs OCC on point reads and writes
+// usage: ./cc_bench [keys] [transactions] [concurrency] [operations per transaction] [write ratio %]
+
+my_task bench_transaction(Table *table,std::vector<std::string> keys,std::vector<bool> writes) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    for (int i = 0;i < (int)keys.size(); i++) {
+        if (writes[i]) {
+            co_await txn.update(keys[i],keys[i] + "_new");
+        } else {
+            co_await txn.select(keys[i]);
+        }
+    }
+    co_yield txn.commit();
+    co_return;
+}
+
+void bench(const std::string &name,ConcurrencyControl concurrency_control,DeadlockPolicy deadlock_policy,int keys,int transactions,int concurrency,int operations,int write_ratio) {
+    std::string btree_file_name = "cc_bench_btree.txt";
+    std::string data_file_name = "cc_bench_data.txt";
+    std::string log_file_name = "cc_bench_log.txt";
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+
+    int commits = 0;
+    double seconds = 0;
+    LockStats stats;
+    {
+        Table table(btree_file_name,data_file_name,log_file_name,concurrency_control,deadlock_policy);
+        for (int i = 0;i < keys; i++) {
+            table.btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+
+        std::mt19937_64 rnd(0);
+        std::uniform_int_distribution<int> key_dist(0,keys - 1);
+        std::uniform_int_distribution<int> ratio_dist(0,99);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int done = 0;done < transactions; done += concurrency) {
+            for (int t = 0;t < concurrency && done + t < transactions; t++) {
+                std::vector<std::string> txn_keys;
+                std::vector<bool> txn_writes;
+                for (int i = 0;i < operations; i++) {
+                    txn_keys.push_back("key" + std::to_string(key_dist(rnd)));
+                    txn_writes.push_back(ratio_dist(rnd) < write_ratio);
+                }
+                table.add_transaction(bench_transaction(&table,txn_keys,txn_writes));
+            }
+            for (bool commit : table.exec_transaction()) {
+                commits += commit;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        seconds = std::chrono::duration<double>(end - start).count();
+        stats = table.lock_manager.stats;
+    }
+
+    std::cout << std::left << std::setw(12) << name
+              << std::setw(10) << transactions
+              << std::setw(10) << commits
+              << std::setw(10) << transactions - commits
+              << std::setw(10) << stats.waits
+              << std::setw(12) << std::fixed << std::setprecision(3) << seconds
+              << std::setprecision(1) << transactions / seconds << std::endl;
+
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+}
+
+int main(int argc,char *argv[]) {
+    int keys         = argc > 1 ? atoi(argv[1]) : 10000;
+    int transactions = argc > 2 ? atoi(argv[2]) : 2000;
+    int concurrency  = argc > 3 ? atoi(argv[3]) : 8;
+    int operations   = argc > 4 ? atoi(argv[4]) : 8;
+    int write_ratio  = argc > 5 ? atoi(argv[5]) : 20;
+
+    std::cout << "keys " << keys << " concurrency " << concurrency
+              << " operations " << operations << " write_ratio " << write_ratio << "%" << std::endl;
+    std::cout << std::left << std::setw(12) << "mode"
+              << std::setw(10) << "txns"
+              << std::setw(10) << "commits"
+              << std::setw(10) << "aborts"
+              << std::setw(10) << "waits"
+              << std::setw(12) << "seconds"
+              << "txn/s" << std::endl;
+    bench("wait-die",ConcurrencyControl::S2PL,DeadlockPolicy::WaitDie,keys,transactions,concurrency,operations,write_ratio);
+    bench("wound-wait",ConcurrencyControl::S2PL,DeadlockPolicy::WoundWait,keys,transactions,concurrency,operations,write_ratio);
+    bench("detection",ConcurrencyControl::S2PL,DeadlockPolicy::Detection,keys,transactions,concurrency,operations,write_ratio);
+    bench("OCC",ConcurrencyControl::OCC,DeadlockPolicy::WaitDie,keys,transactions,concurrency,operations,write_ratio);
+    return 0;
+}
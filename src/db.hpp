@@ -1,18 +1,31 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <optional>
 #include <vector>
 #include <fstream>
 #include <deque>
+#include <list>
+#include <limits>
 #include <set>
+#include <algorithm>
+#include <unordered_map>
 #include <memory>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
 #include <utility>
 #include <coroutine>
+#include <functional>
+#include <memory_resource>
+#include <array>
+#include <bit>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
@@ -24,6 +37,7 @@
 
 struct my_task;
 struct Transaction;
+struct Profiler;
 enum struct TryLockResult;
 struct DataOperation;
 using result = std::tuple<Transaction*,TryLockResult,DataOperation>;
@@ -37,10 +51,47 @@ unsigned int crc32(const std::string &s);
 unsigned int crc32(const char *s,int len);
 std::string to_hex(unsigned int number);
 unsigned int from_hex(const std::string &s);
-void file_sync(const std::string &file_name);
 unsigned int file_size(const std::string &file_name);
 void error(const char *s);
 
+const int HISTOGRAM_BUCKETS = 40;
+
+// log2 buckets of microseconds: bucket 0 holds < 1us, bucket i holds [2^(i-1),2^i)us
+struct LatencyHistogram {
+    unsigned long long buckets[HISTOGRAM_BUCKETS];
+    unsigned long long count;
+    double sum_us;
+    double max_us;
+
+    LatencyHistogram();
+
+    void add(double us);
+    double mean(void) const;
+    double percentile(double p) const; // upper bound of the bucket holding the p-quantile
+};
+
+double elapsed_us(std::chrono::steady_clock::time_point start);
+
+// I/O of one file. always on, a clock read costs far less than the I/O
+struct IOStats {
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned long long syncs;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    LatencyHistogram read_latency;
+    LatencyHistogram write_latency;
+    LatencyHistogram sync_latency;
+
+    IOStats();
+
+    void add_read(size_t bytes,double us);
+    void add_write(size_t bytes,double us);
+    void add_sync(double us);
+};
+
+void file_sync(const std::string &file_name,IOStats &io_stats);
+
 //
 // lock_manager.cpp
 //
@@ -58,14 +109,15 @@ struct Lock {
 
     // used when lock_kind = Share
     int txnnum;
-    std::set<int> readers;
+    std::vector<int> readers; // a handful of txnids, scanned linearly
 
     Lock();
     Lock(LockKind lock_kind,int txnid);
-    Lock(LockKind lock_kind,int txnnum,const std::set<int>& readers);
+    Lock(LockKind lock_kind,int txnnum,const std::vector<int>& readers);
 
     bool has_shared_lock(void);
     bool has_exclusive_lock(void);
+    bool has_reader(int txnid);
     void add_reader(int txnid);
     void delete_reader(int txnid);
     bool has_priority(int txnid_); // if Lock.txnid has higher priority than txnid  return true 
@@ -80,13 +132,158 @@ enum struct TryLockResult {
     Abort,
 };
 
-struct LockManager {
-    std::map<std::string,Lock> lock_table;
+// key and its hash, the hash is computed once per lock manager call
+// and picks both the partition and the bucket
+struct LockKey {
+    std::string_view key;
+    size_t hash;
+
+    LockKey(std::string_view key);
+};
+
+// key stored in a lock table, keeps its hash so rehashing never rehashes strings
+struct LockName {
+    std::string key;
+    size_t hash;
+};
+
+struct LockKeyHash {
+    using is_transparent = void;
+    size_t operator()(const LockName &name) const { return name.hash; }
+    size_t operator()(const LockKey &key) const { return key.hash; }
+};
+
+struct LockKeyEqual {
+    using is_transparent = void;
+    bool operator()(const LockName &a,const LockName &b) const { return a.hash == b.hash && a.key == b.key; }
+    bool operator()(const LockName &a,const LockKey &b) const { return a.hash == b.hash && a.key == b.key; }
+    bool operator()(const LockKey &a,const LockName &b) const { return a.hash == b.hash && a.key == b.key; }
+};
+
+const int LOCK_PARTITIONS = 16;
+
+// partitions share nothing, so each one only needs its own latch once
+// lock requests come from more than one thread
+struct LockPartition {
+    std::unordered_map<LockName,Lock,LockKeyHash,LockKeyEqual> lock_table;
+};
+
+// the request a suspended coroutine waits for
+struct BlockedRequest {
+    std::coroutine_handle<> handle;
+    std::function<TryLockResult()> try_lock; // the awaiter's lock attempt
+};
+
+enum struct DeadlockPolicy {
+    WaitDie,   // a younger requester aborts, an older one waits
+    WoundWait, // an older requester aborts the younger holders and waits
+    Detection, // always wait, abort the requester that closes a cycle in the waits-for graph
+};
+
+struct LockStats {
+    unsigned long long acquisitions;
+    unsigned long long waits;     // every Wait answer: a request that blocks, and each grant_woken retry that blocks again
+    unsigned long long aborts;
+    unsigned long long wounds;    // WoundWait: holders aborted by an older requester
+    unsigned long long deadlocks; // Detection: cycles found
+    unsigned long long escalations; // key locks replaced by one table lock
+};
+
+struct KeyContention {
+    unsigned long long acquisitions; // sampled, one per HotKeys::sample_period grants
+    unsigned long long waits;
+    unsigned long long aborts;
+    unsigned long long upgrade_conflicts; // the waits and aborts of upgrades blocked by other readers
+
+    // upgrade_conflicts is a breakdown of waits and aborts, not counted again
+    unsigned long long score(void) const { return waits + aborts; }
+};
+
+const size_t HOT_KEY_CAPACITY = 4096;
 
+// contention per key lock, off while sample_period is 0.
+// at most HOT_KEY_CAPACITY keys are tracked, the less contended half is
+// dropped when a new key does not fit
+struct HotKeys {
+    int sample_period;
+    unsigned long long grants;
+    std::unordered_map<std::string,KeyContention> keys;
+
+    HotKeys();
+
+    KeyContention &entry(std::string_view key);
+    void acquired(std::string_view key);
+    void prune(void);
+    std::vector<std::pair<std::string,KeyContention>> top(int n);
+    void report(std::ostream &out,int n);
+};
+
+// table granularity lock modes, SIX is folded into X
+enum struct LockMode {
+    IS, // key shared locks below
+    IX, // key exclusive locks below
+    S,  // the whole table shared
+    X,  // the whole table exclusive
+};
+
+bool lock_mode_compatible(LockMode a,LockMode b);
+bool lock_mode_covers(LockMode held,LockMode want);
+LockMode lock_mode_combine(LockMode held,LockMode want);
+
+// key locks one transaction may hold before they are escalated to a table lock
+const int LOCK_ESCALATION_THRESHOLD = 5000;
+
+// shared lock on the keys low <= key < high, present or not
+struct RangeLock {
+    std::string low;
+    std::string high;
+    int txnid;
+};
+
+struct LockManager {
+    std::vector<LockPartition> partitions;
+    std::vector<RangeLock> range_locks;
+    std::unordered_map<int,LockMode> table_locks; // txnid -> mode on the table
+    std::unordered_map<int,int> key_locks;        // txnid -> number of key locks granted
+    int escalation_threshold;
+    DeadlockPolicy policy;
+    LockStats stats;
+    HotKeys hot_keys;
+    std::set<int> wounded;                           // WoundWait
+    std::unordered_map<int,std::vector<int>> waits_for; // Detection
+
+    // a coroutine that got Wait is suspended until one of the transactions
+    // it conflicted with finishes. grant_woken then tries its request again,
+    // a decided request hands the coroutine to runnable to be resumed
+    std::unordered_map<int,std::vector<int>> waiters; // holder -> txnids that got Wait from it
+    std::unordered_map<int,BlockedRequest> blocked;   // suspended txnid -> its request
+    std::set<int> woken;                              // blocked txnids whose holder finished, oldest first
+    std::deque<std::pair<std::coroutine_handle<>,TryLockResult>> runnable; // GetLock or Abort
+
+    LockManager(DeadlockPolicy policy = DeadlockPolicy::WaitDie);
+
+    LockPartition &partition(const LockKey &key);
+    int size(void);
     TryLockResult try_shared_lock(const std::string& s,int txnid);
     TryLockResult try_exclusive_lock(const std::string& s,int txnid);
     TryLockResult try_upgrade_lock(const std::string& s,int txnid);
-    void unlock(const std::string& s,int txnid);
+    TryLockResult try_range_lock(const std::string& low,const std::string& high,int txnid);
+    TryLockResult try_table_lock(LockMode mode,int txnid);
+    std::optional<LockMode> table_lock(int txnid);
+    TryLockResult upgrade(Lock &lock,int txnid,std::string_view key);
+    std::vector<int> range_holders(const std::string& s,int txnid);
+    TryLockResult conflict(Lock &lock,int txnid,std::string_view key);
+    TryLockResult conflict(const std::vector<int> &holders,int txnid,std::string_view key = "");
+    bool closes_cycle(int txnid);
+    void granted(int txnid);
+    void key_granted(int txnid,std::string_view key);
+    void block(int txnid,std::coroutine_handle<> handle,std::function<TryLockResult()> try_lock);
+    void unblock(int txnid);
+    void wake(int txnid);
+    void grant_woken(void);
+    void escalate(int txnid);
+    void unlock(std::string_view s,int txnid);
+    void finish(int txnid);
 };
 
 //
@@ -100,6 +297,8 @@ struct Page {
     bool dirty;
     int pin_count;
     int access;
+    bool writing; // the background writer is writing a copy, the frame must stay
+    bool prefetched; // read ahead and not accessed yet
     char page[PAGESIZE];
 
     Page();
@@ -119,41 +318,166 @@ struct Page {
 
 struct DiskManager {
     std::string file_name;
-    std::fstream file_stream;
+    int fd;
     int page_num;
+    IOStats io_stats;
 
     DiskManager(const std::string &file_name);
+    DiskManager(const DiskManager&) = delete;
     ~DiskManager();
 
     Page fetch_page(int pageid);
     void write_page(int pageid,Page &page);
+    void write(int pageid,const char page[]);
+    void fetch_pages(int first,int count,char buf[]);
     void flush(void);
     int allocate_new_page(void);
     void clear_file(void);
 };
 
+//
+// replacement.cpp
+//
+
+struct BufferManager;
+
+enum struct ReplacementPolicy {
+    Clock, // second chance on Page::access
+    TwoQ,  // Johnson and Shasha's 2Q: pages seen once stay in a FIFO, a scan cannot flush the LRU
+    ARC,   // Megiddo and Modha's adaptive replacement cache
+};
+
+// pageids from most to least recently used
+struct LruList {
+    std::list<int> order;
+    std::unordered_map<int,std::list<int>::iterator> where;
+
+    bool contains(int pageid) const;
+    int size(void) const;
+    void push_front(int pageid);
+    void erase(int pageid);
+    int pop_back(void);
+    void clear(void);
+    // least recently used resident page the buffer manager may evict, -1 if none
+    int victim(BufferManager &buffer_manager) const;
+};
+
+struct TwoQueue {
+    LruList a1in;  // resident, seen once, FIFO
+    LruList a1out; // ghosts of pages evicted from a1in
+    LruList am;    // resident, seen again, LRU
+    int kin;
+    int kout;
+
+    TwoQueue(int frames);
+
+    void hit(int pageid);
+    int victim(BufferManager &buffer_manager);
+    void admit(int pageid);
+    void clear(void);
+};
+
+struct AdaptiveCache {
+    LruList t1; // resident, seen once recently
+    LruList t2; // resident, seen at least twice recently
+    LruList b1; // ghosts evicted from t1
+    LruList b2; // ghosts evicted from t2
+    int c;      // frames
+    double p;   // target size of t1
+
+    AdaptiveCache(int frames);
+
+    void hit(int pageid);
+    void miss(int pageid);
+    int victim(int pageid,BufferManager &buffer_manager);
+    void admit(int pageid);
+    void clear(void);
+};
+
 //
 // buffermanager.cpp
 //
 
 extern const int MAX_BUFFER_SIZE;
 
+struct BufferStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long dirty_writebacks; // evicted frames that had been modified
+    unsigned long long sweep_steps;      // frames the clock hand passed over in evict()
+    unsigned long long max_sweep;        // longest single evict() sweep
+    unsigned long long background_writes; // frames cleaned by the background writer
+    unsigned long long readahead_ios;     // extents read ahead, one pread each
+    unsigned long long readahead_pages;   // pages read ahead
+    unsigned long long readahead_hits;    // pages read ahead and then accessed
+};
+
+const int READAHEAD_PAGES = 32;  // largest extent read ahead
+const int READAHEAD_TRIGGER = 2; // misses on consecutive pageids before reading ahead
+
+const double WRITER_DIRTY_RATIO = 0.1;
+const int WRITER_INTERVAL_MS = 10;
+
 struct BufferManager {
     DiskManager disk_manager;
     std::vector<Page> pages;
     std::map<int,int> pagetable;
     int victim_index_base;
-
-    BufferManager(const std::string &file_name);
+    int free_list_head; // -1 if there is no free page
+    BufferStats stats;
+    ReplacementPolicy policy;
+    TwoQueue two_queue;
+    AdaptiveCache adaptive_cache;
+    int last_reference; // pageid of the previous frame() call
+
+    // background writer. it keeps the dirty frames at most dirty_ratio of the
+    // pool, cleaning the frames the clock hand reaches first, so eviction finds
+    // clean victims. every call takes latch while it runs, and only then
+    std::thread writer;
+    std::mutex latch;
+    std::condition_variable writer_cv; // wakes the writer, and waiters for writes in flight
+    bool writer_stop;
+    double dirty_ratio;
+    std::chrono::milliseconds writer_interval;
+    int writes_in_flight;
+
+    // read-ahead. a run of misses on consecutive pageids reads the next
+    // readahead_pages pages in one I/O, scans also pass the pages they will visit
+    int readahead_pages; // 0 disables it
+    int last_miss;
+    int sequential_misses;
+
+    BufferManager(const std::string &file_name,ReplacementPolicy policy = ReplacementPolicy::Clock);
     ~BufferManager();
 
+    std::unique_lock<std::mutex> latch_guard(void);
+    void start_writer(double dirty_ratio = WRITER_DIRTY_RATIO,
+                      std::chrono::milliseconds interval = std::chrono::milliseconds(WRITER_INTERVAL_MS));
+    void stop_writer(void);
+    void writer_loop(void);
+    void clean(std::unique_lock<std::mutex> &guard);
+    int dirty_frames(void);
+    int frame(int pageid,std::unique_lock<std::mutex> &guard);
+    int install(const Page &page,std::unique_lock<std::mutex> &guard);
+    int prefetch(int first,int count,std::unique_lock<std::mutex> &guard);
+    void read_ahead(std::vector<int> pageids);
     void fetch_page(int pageid);
     int  create_new_page(void);
+    int  allocate_page(void);
+    void free_page(int pageid);
+    bool confirm_checksum(int pageid);
     const char *read_page(int pageid,int offset,int len);
     void write_page(int pageid,const char buf[],int offset,int len);
+    void write_back(int page_index);
     void evict_page(int pageid);
     void flush(void);
-    int evict(void);  
+    void flush_range(int first,int last);
+    void discard(void);
+    int evict(int pageid,std::unique_lock<std::mutex> &guard);
+    int victim(int pageid);
+    bool evictable(int pageid);
+    int pinned_frames(void);
 };
 
 //
@@ -162,6 +486,18 @@ struct BufferManager {
 
 extern const int checksum_len;
 
+// decoded copy of a node page, read with a single read_page call
+struct NodeImage {
+    bool is_leaf;
+    int keys_size;
+    std::vector<int> children;
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+
+    bool isfull(void) const;
+    int lower_bound(std::string_view key) const;
+};
+
 struct Node {
     BufferManager *buffer_manager;
     int pageid;
@@ -180,15 +516,19 @@ struct Node {
     void set_is_leaf(bool is_leaf);
     void set_keys_size(int keys_size);
     void set_child_pageid(int index,int child_pageid);
-    void set_keys(int index,const std::string &key);
-    void set_values(int index,const std::string &value);
+    void set_keys(int index,std::string_view key);
+    void set_values(int index,std::string_view value);
+    NodeImage load(void);
 
-    std::optional<std::string> search(const std::string &key);
-    bool update(const std::string &key,const std::string &value);
-    void insert(const std::string &key,const std::string &value);
-    bool del(const std::string &key);
+    std::optional<std::string> search(std::string_view key);
+    bool update(std::string_view key,const std::string &value);
+    void insert(std::string_view key,std::string_view value);
+    void insert(std::string_view key,std::string_view value,NodeImage image);
+    std::optional<std::string> upsert(std::string_view key,std::string_view value,NodeImage image);
+    std::optional<std::string> erase(std::string_view key);
 
     void splitchild(int idx);
+    NodeImage splitchild(int idx,NodeImage &image,NodeImage &child_image);
     void leftshift(int index);
     void rightshift(int index);
     void merge(int index);
@@ -198,28 +538,64 @@ struct Node {
     std::pair<std::string,std::string> max_data(void);
     bool isfull();
 
+    void range(const std::string &low,const std::string &high,std::map<std::string,std::string> &datas);
     std::map<std::string,std::string> all_data(void);
     void show();
 };
 
+//
+// superblock.cpp
+//
+
+extern const int superblock_pageid;
+
+struct Superblock {
+    BufferManager *buffer_manager;
+
+    Superblock(BufferManager *buffer_manager);
+
+    void format(void);
+    bool validate(void);
+
+    int version(void);
+    int page_size(void);
+    int root_pageid(void);
+    int free_list_head(void);
+    unsigned long long checkpoint_lsn(void);
+
+    void set_root_pageid(int root_pageid);
+    void set_free_list_head(int free_list_head);
+    void set_checkpoint_lsn(unsigned long long checkpoint_lsn);
+};
+
 //
 // btree_ondisk.cpp
 //
 
 struct BTree {
     BufferManager buffer_manager;
+    Superblock superblock;
     Node *root;  
+    bool valid; // false if the file was unusable and has been reinitialized
 
-    BTree(const std::string &file_name);
+    BTree(const std::string &file_name,ReplacementPolicy policy = ReplacementPolicy::Clock);
     ~BTree();
 
-    std::optional<std::string> search(const std::string &key);
-    bool update(const std::string &key,const std::string &value);
-    void insert(const std::string &key,const std::string &value);
-    bool del(const std::string &key);
+    void init(void);
+    void set_root(int pageid);
+    void set_checkpoint_lsn(unsigned long long lsn);
+
+    std::optional<std::string> search(std::string_view key);
+    bool update(std::string_view key,const std::string &value);
+    void insert(std::string_view key,std::string_view value);
+    bool del(std::string_view key);
+    // one descent, the old value is returned (nullopt if key was absent)
+    std::optional<std::string> upsert(std::string_view key,std::string_view value);
+    std::optional<std::string> erase(std::string_view key);
     void clear(void);
     void flush(void);
 
+    std::map<std::string,std::string> range(const std::string &low,const std::string &high);
     std::map<std::string,std::string> all_data(void);
     void show();
 };
@@ -233,16 +609,20 @@ enum struct LogKind {
     update,
     del,
     commit,
+    abort, // the records since the last commit are void
 };
 
 struct LogManager {
     std::string log_file_name;
     std::ofstream log_file_output;
+    unsigned long long lsn; // byte offset of the next record since the database was created
+    IOStats io_stats; // records appended are writes, log_flush is a sync
+    bool empty;       // nothing was appended since the log was erased
 
     LogManager(std::string log_file_name);
     ~LogManager();
 
-    void log(LogKind log_kind,const std::string &key,const std::string &value);
+    void log(LogKind log_kind,std::string_view key,std::string_view value);
     void log_flush();
     void erase_log();
 };
@@ -258,6 +638,8 @@ enum struct OpeKind {
     insert,
     update,
     del,
+    scan, // key = low, value = high
+    lock_table, // key = "S" or "X"
 };
 
 struct DataOperation {
@@ -265,44 +647,196 @@ struct DataOperation {
     std::string key;
     std::string value;
 
-    DataOperation(OpeKind ope_kind,const std::string &key,const std::string &value)
+    // built once per operation and moved from there into the promise
+    DataOperation(OpeKind ope_kind,std::string &&key,std::string &&value)
         :ope_kind(ope_kind),
-         key(key),
-         value(value) {}
+         key(std::move(key)),
+         value(std::move(value)) {}
 };
 
 enum State {
     Execute,
-    Wait,
+    Wait,    // suspended in LockManager::blocked, resumed when its request is granted
+    Backoff, // aborted, restarted from its factory after backoff rounds
     Done,
 };
 
+using task_factory = std::function<my_task()>;
+
 struct Scheduler {
     std::vector<my_task> tasks;
     std::vector<Transaction*> transactions;
     std::vector<State> states;
 
+    // retry of aborted tasks
+    std::vector<task_factory> factories; // empty if the task is not retried
+    std::vector<int> txnids;             // kept across retries so a retried transaction ages
+    std::vector<int> retries;
+    std::vector<int> backoff;            // remaining rounds in State::Backoff
+    int max_retries;
+    int backoff_base;                    // rounds before the first retry, doubled on each retry
+    int running;                         // index of the task being resumed, -1 outside start()
+    unsigned long long retry_count;      // retries since the scheduler was created
+    Profiler *profiler;                  // Table::profiler, nullptr if the scheduler runs alone
+    LockManager *lock_manager;           // Table::lock_manager, grants the requests of waiting tasks
+    std::vector<std::chrono::steady_clock::time_point> wait_start; // entry into State::Wait
+    // closed loop: the slot of a finished task is refilled with the task next_task returns,
+    // an empty factory once nothing is left. slots are reused, so the tasks report their outcome
+    std::function<task_factory(void)> next_task;
+    // called whenever a task commits or gives up, Table dumps its stats from it
+    std::function<void(void)> task_finished;
+
+    Scheduler();
+
     void add_task(my_task &&task);
+    void add_task(task_factory factory);
+    void register_transaction(Transaction *txn);
+    int txnid(void);
+    void abort_task(int idx,int &finish_task_count);
+    void finish_task(int idx,int &finish_task_count);
+    int task_index(std::coroutine_handle<> handle);
+    void stepped(int idx,std::chrono::steady_clock::time_point slice_start,std::vector<bool> &commit,int &finish_task_count);
+    void resume_granted(std::vector<bool> &commit,int &finish_task_count);
     std::vector<bool> start(void); // return true if txn commit 
 };
 
+//
+// version_store.cpp
+//
+
+// value of a key before the commit with timestamp ts overwrote it
+// value = nullopt if the key did not exist
+struct Version {
+    unsigned long long ts;
+    std::optional<std::string> value;
+};
+
+// lets write_ts be looked up by a string_view without building a key
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
+// undo store for snapshot reads
+// before-images are kept only while a read-only transaction is running
+struct VersionStore {
+    unsigned long long commit_ts; // timestamp of the latest commit
+    std::multiset<unsigned long long> snapshots;
+    std::map<std::string,std::deque<Version>,std::less<>> undo;
+
+    // OCC validation
+    // commit timestamp of the latest write per key, kept while an OCC transaction is running
+    std::unordered_map<std::string,unsigned long long,StringHash,std::equal_to<>> write_ts;
+    std::multiset<unsigned long long> occ_txns; // begin timestamps of running OCC transactions
+
+    VersionStore();
+
+    unsigned long long begin_snapshot(void);
+    void end_snapshot(unsigned long long snapshot_ts);
+    bool has_snapshot(void);
+    unsigned long long next_commit_ts(void);
+    void record(std::string_view key,unsigned long long ts,const std::optional<std::string> &value);
+    std::optional<std::string> read(const std::string &key,unsigned long long snapshot_ts,BTree &btree);
+    std::map<std::string,std::string> range(const std::string &low,const std::string &high,unsigned long long snapshot_ts,BTree &btree);
+    void gc(void);
+
+    unsigned long long begin_occ(void);
+    void end_occ(unsigned long long begin_ts);
+    void record_write(std::string_view key,unsigned long long ts);
+    unsigned long long last_write_ts(std::string_view key);
+    unsigned long long last_write_ts(const std::string &low,const std::string &high);
+};
+
+//
+// profiler.cpp
+//
+
+enum struct Phase {
+    lock_wait,   // suspended in State::Wait
+    execution,   // resumed by the Scheduler, commit excluded
+    log_append,
+    log_flush,
+    index_apply, // btree and version store updates at commit
+};
+
+const int PHASE_COUNT = 5;
+
+const char *phase_name(Phase phase);
+
+// per-transaction phase timing. every phase of a transaction is summed while
+// it runs and added to the histogram of that phase when the transaction ends.
+// disabled, now() and record() do not read the clock.
+struct Profiler {
+    bool enabled;
+    LatencyHistogram phases[PHASE_COUNT];
+    std::unordered_map<int,std::array<double,PHASE_COUNT>> running; // txnid -> us per phase
+    // Chrome trace-event JSON, one row per txnid. events are written only while enabled
+    std::ofstream trace;
+    bool trace_empty;
+    std::chrono::steady_clock::time_point origin;
+
+    Profiler();
+    ~Profiler();
+
+    std::chrono::steady_clock::time_point now(void);
+    void record(int txnid,Phase phase,std::chrono::steady_clock::time_point start,std::chrono::steady_clock::time_point end);
+    void finish(int txnid);
+    void start_trace(const std::string &file_name);
+    void stop_trace(void);
+    void report(std::ostream &out);
+};
+
 // 
 // table.cpp
 //
 
+enum struct ConcurrencyControl {
+    S2PL, // strict two phase locking with wait-die
+    OCC,  // optimistic, reads are validated at commit
+};
+
+// snapshot returned by Table::stats()
+struct TableStats {
+    BufferStats buffer;
+    int resident_pages;
+    int pinned_frames;
+    int buffer_size;
+    LockStats lock;
+    IOStats btree_io;
+    IOStats log_io;
+    IOStats data_io;
+};
+
 struct Table {
     BTree btree;
+    ConcurrencyControl concurrency_control;
     std::string data_file_name;
     LogManager log_manager;
     LockManager lock_manager;
+    VersionStore version_store;
     Scheduler scheduler;
-
-    Table(const std::string &btree_file_name,const std::string &data_file_name,const std::string &log_file_name);
+    Profiler profiler;
+    IOStats data_io; // fsyncs of the database dump file at checkpointing
+    // a stats line is appended to stats_dump_file_name when a transaction finishes
+    // and stats_dump_interval has passed since the last one. "" disables it
+    std::string stats_dump_file_name;
+    std::chrono::milliseconds stats_dump_interval;
+    std::chrono::steady_clock::time_point last_stats_dump;
+
+    Table(const std::string &btree_file_name,const std::string &data_file_name,const std::string &log_file_name,
+          ConcurrencyControl concurrency_control = ConcurrencyControl::S2PL,
+          DeadlockPolicy deadlock_policy = DeadlockPolicy::WaitDie,
+          ReplacementPolicy replacement_policy = ReplacementPolicy::Clock);
 
     void checkpointing(); 
     void recovery();  
     void add_transaction(my_task&& task);
+    void add_transaction(task_factory factory);
     std::vector<bool> exec_transaction(void);
+    TableStats stats(void);
+    void dump_stats(const std::string &file_name);
+    void dump_stats_if_due(void);
+    void set_stats_dump(const std::string &file_name,std::chrono::milliseconds interval);
 };
 
 
@@ -318,45 +852,102 @@ enum struct DataState {
 struct DataWrite {
     DataState first_data_state;
     OpeKind last_ope_kind;
-    std::optional<std::string> value;
+    std::optional<std::string_view> value; // stored in Transaction::arena
 
     DataWrite()
         :first_data_state(DataState::in_keys),
          last_ope_kind(OpeKind::select),
          value(std::nullopt) {}
-    DataWrite(DataState first_data_state,OpeKind last_ope_kind,const std::optional<std::string> &value)
+    DataWrite(DataState first_data_state,OpeKind last_ope_kind,std::optional<std::string_view> value)
         :first_data_state(first_data_state),
          last_ope_kind(last_ope_kind),
          value(value) {}
 };
 
+int fresh_txnid(void);
+
+const size_t ARENA_INITIAL_SIZE = 4096;
+
+// memory of one transaction: its keys, values and the nodes of its read and
+// write sets. nothing is freed one by one, release() at commit or rollback
+// frees everything. a small transaction fits in initial and never calls malloc.
+struct Arena {
+    char initial[ARENA_INITIAL_SIZE];
+    std::pmr::monotonic_buffer_resource resource;
+
+    Arena();
+    Arena(const Arena&) = delete;
+
+    std::string_view store(std::string_view s);
+    void release(void);
+};
+
+using WriteSet = std::pmr::unordered_map<std::string_view,DataWrite>;
+using ReadSet  = std::pmr::unordered_map<std::string_view,std::optional<std::string_view>>;
+
 struct Transaction {
     Table *table; 
-    std::map<std::string,DataWrite> write_set;
-    std::map<std::string,std::optional<std::string>> read_set;
+    Arena arena; // before the sets allocated from it
+    WriteSet write_set;
+    ReadSet read_set;
+    std::pmr::unordered_map<std::string_view,unsigned long long> read_ts; // OCC: commit timestamp when each key was read
+    std::vector<std::tuple<std::string,std::string,unsigned long long>> scan_ts; // OCC: ranges scanned and when
+    std::map<std::string,std::string> scan_result;    // result of the latest scan
     bool conditional_write_error;
+    bool read_only_error; // a write in a read-only transaction
     int txnid;
+    bool read_only; // read-only transactions read a snapshot without locks
+    bool occ;
+    unsigned long long snapshot_ts; // snapshot of a read-only transaction or begin of an OCC transaction
 
     Transaction(Table *table);
 
-    int begin();
+    int begin(bool read_only = false);
     bool commit();
     bool rollback();
-    result select(const std::string &key);
-    result insert(const std::string &key,const std::string &value);
-    result update(const std::string &key,const std::string &value);
-    result del(const std::string &key);
+    result select(std::string key);
+    result insert(std::string key,std::string value);
+    result update(std::string key,std::string value);
+    result del(std::string key);
+    result scan(std::string low,std::string high);
+    result lock_table(bool exclusive);
 
     std::optional<std::string> get_value(const std::string &key);
+    std::optional<std::string_view> store(const std::optional<std::string> &value);
+    void add_write(const std::string &key,DataWrite &&data_write);
+    TryLockResult reject_write(void);
+    void release(void);
     TryLockResult select_internal(const std::string &key);
     TryLockResult insert_internal(const std::string &key,const std::string &value);
     TryLockResult update_internal(const std::string &key,const std::string &value);
     TryLockResult del_internal(const std::string &key);
+    TryLockResult scan_internal(const std::string &low,const std::string &high);
+    TryLockResult lock_table_internal(bool exclusive);
+    TryLockResult retry(const DataOperation &data_operation);
+    bool validate(void);
     void unlock(void);
 };
 
 // concurrent
 
+// coroutine frames of one kind have the same size, a freed frame is kept
+// on a free list of its size class and handed to the next task.
+struct FramePool {
+    std::vector<std::vector<void*>> free_frames; // size class -> frames
+    unsigned long long allocations; // frames taken from malloc
+
+    FramePool();
+    ~FramePool();
+
+    void *allocate(size_t size);
+    void deallocate(void *frame,size_t size);
+};
+
+const size_t FRAME_POOL_ALIGN = 64;
+const size_t FRAME_POOL_MAX_FRAME = 64 * 1024; // larger frames bypass the pool
+
+FramePool &frame_pool(void);
+
 struct my_task {
     struct promise_type {
         int txnid_;
@@ -370,7 +961,15 @@ struct my_task {
              waiting_(false),
              abort_(false),
              commit_(false),
-             data_operation_(DataOperation(OpeKind::select,"","")) {}
+             data_operation_(DataOperation(OpeKind::select,{},{})) {}
+
+        static void *operator new(size_t size) noexcept {
+            return frame_pool().allocate(size);
+        }
+
+        static void operator delete(void *frame,size_t size) {
+            frame_pool().deallocate(frame,size);
+        }
 
         static auto get_return_object_on_allocation_failure() { 
             return my_task{nullptr}; 
@@ -400,6 +999,7 @@ struct my_task {
         }
 
         auto yield_value(bool commit) {
+            waiting_ = false;
             commit_ = commit;
             abort_ = !commit;
             return std::suspend_always{};
@@ -408,24 +1008,28 @@ struct my_task {
 
         struct awaiter {
             Transaction *txn;
-            DataOperation data_operation;
+            const DataOperation *data_operation; // promise_type::data_operation_
+            bool waiting;
 
-            awaiter(Transaction *txn,const DataOperation &data_operation)
+            awaiter(Transaction *txn,const DataOperation *data_operation,bool waiting)
                 :txn(txn), 
-                 data_operation(data_operation) {}
+                 data_operation(data_operation),
+                 waiting(waiting) {}
 
             bool await_ready() const { 
                 // true  -> continue execution
                 // false -> suspend  execution
+                // the lock was already tried in Transaction::select and friends.
+                // every operation is one step of the round-robin, so always suspend
                 return false;
             }
 
             std::optional<std::string> await_resume() {
                 // resumeした直後にする処理
                 // return select result;
-                if (data_operation.ope_kind == OpeKind::select) {
+                if (data_operation->ope_kind == OpeKind::select) {
                     // select
-                    return txn->get_value(data_operation.key);
+                    return txn->get_value(data_operation->key);
                 } else {
                     // updata insert delete
                     return std::nullopt;
@@ -434,7 +1038,14 @@ struct my_task {
 
             void await_suspend(std::coroutine_handle<> h) {
                 // suspendした直後にする処理。次のawait_resumeの準備をする.
+                // a waiting coroutine is parked in the lock manager, which tries
+                // the lock again and resumes h once it is granted
+                if (waiting) {
+                    block(h);
+                }
             }
+
+            void block(std::coroutine_handle<> h);
             // * image *
             // co_await e = {
             //     awaiter aw = await_transform(e);
@@ -450,11 +1061,13 @@ struct my_task {
             // }
         };
 
-        awaiter await_transform(const result &result) {
+        // the operation is moved into the promise. the awaiter reads it, and the
+        // BlockedRequest it registers retries it from there when grant_woken runs
+        awaiter await_transform(result &&result) {
             waiting_ = (get<1>(result)) == TryLockResult::Wait;
             abort_ = (get<1>(result)) == TryLockResult::Abort;
-            data_operation_ = get<2>(result);
-            return awaiter(get<0>(result),get<2>(result));
+            data_operation_ = std::move(get<2>(result));
+            return awaiter(get<0>(result),&data_operation_,waiting_);
         }
     };
     using handle = std::coroutine_handle<promise_type>;
@@ -466,6 +1079,10 @@ struct my_task {
         return coro && !coro.done(); 
     }
 
+    bool owns(std::coroutine_handle<> h) {
+        return coro && coro.address() == h.address();
+    }
+
     int txnid(void) { 
         return coro.promise().txnid_; 
     }
@@ -482,16 +1099,25 @@ struct my_task {
         return coro.promise().commit_;
     }
 
-    DataOperation data_operation(void) {
+    const DataOperation &data_operation(void) {
         return coro.promise().data_operation_;
     }
 
     void destroy_handle(void) { 
         if (coro) coro.destroy(); 
+        coro = nullptr;
     }
 
     my_task(my_task const&) = delete;
     my_task(my_task && rhs) : coro(rhs.coro) { rhs.coro = nullptr; }
+    my_task &operator=(my_task && rhs) {
+        if (this != &rhs) {
+            destroy_handle();
+            coro = rhs.coro;
+            rhs.coro = nullptr;
+        }
+        return *this;
+    }
     ~my_task() { destroy_handle(); }
 private:
     my_task(handle h) : coro(h) {}
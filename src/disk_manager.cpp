@@ -3,59 +3,78 @@
 DiskManager::DiskManager(const std::string &file_name)
         :file_name(file_name)
 {
-    std::ofstream output_file_stream;
-    output_file_stream.open(file_name,std::ios::app);
-    if(!output_file_stream) {
-        error("open(disk_manager)");
-    }
-    output_file_stream.close();
-    file_stream.open(file_name);
-    if (!file_stream) {
+    // pread/pwrite take the offset with them, so the background writer
+    // and the foreground can do I/O on the same descriptor
+    fd = open(file_name.c_str(),O_RDWR|O_CREAT,0644);
+    if (fd == -1) {
         error("open(disk_manager)");
     }
     page_num = file_size(file_name) / PAGESIZE;
 }
 
 DiskManager::~DiskManager() {
-    file_stream.close();
+    close(fd);
 }
 
 Page DiskManager::fetch_page(int pageid) {
     assert(pageid < page_num);
-    file_stream.seekg(pageid * PAGESIZE,std::ios_base::beg);
+    auto start = std::chrono::steady_clock::now();
     char page[PAGESIZE];
-    file_stream.read(page,PAGESIZE);
-    assert(!file_stream.fail());
+    if (pread(fd,page,PAGESIZE,(off_t)pageid * PAGESIZE) != PAGESIZE) {
+        error("pread(fetch_page)");
+    }
+    io_stats.add_read(PAGESIZE,elapsed_us(start));
     return Page(pageid,page);
 }
+
+// count consecutive pages in one I/O
+void DiskManager::fetch_pages(int first,int count,char buf[]) {
+    assert(0 < count && first + count <= page_num);
+    auto start = std::chrono::steady_clock::now();
+    ssize_t size = (ssize_t)count * PAGESIZE;
+    if (pread(fd,buf,size,(off_t)first * PAGESIZE) != size) {
+        error("pread(fetch_pages)");
+    }
+    io_stats.add_read(size,elapsed_us(start));
+}
     
 void DiskManager::write_page(int pageid,Page &page) {
     assert(pageid < page_num);
     if (page.dirty) {
-        file_stream.seekg(pageid * PAGESIZE,std::ios_base::beg);
-        file_stream.write(page.page,PAGESIZE);
+        auto start = std::chrono::steady_clock::now();
+        write(pageid,page.page);
         page.dirty = false;
+        io_stats.add_write(PAGESIZE,elapsed_us(start));
+    }
+}
+
+// no bookkeeping, the background writer calls it without the latch
+void DiskManager::write(int pageid,const char page[]) {
+    if (pwrite(fd,page,PAGESIZE,(off_t)pageid * PAGESIZE) != PAGESIZE) {
+        error("pwrite(write_page)");
     }
 }
 
 void DiskManager::flush(void) {
-    if (file_stream.sync() == -1) {
+    auto start = std::chrono::steady_clock::now();
+    if (fdatasync(fd) == -1) {
         error("DiskManager::flush");
     }
+    io_stats.add_sync(elapsed_us(start));
 }
 
 int DiskManager::allocate_new_page(void) {
     int pageid = page_num;
     ++page_num;
-    if (truncate(file_name.c_str(),page_num * PAGESIZE) == -1) {
+    if (ftruncate(fd,(off_t)page_num * PAGESIZE) == -1) {
         error("truncate(allocate_new_page)");
     }
     return pageid;
 }
 
 void DiskManager::clear_file(void) {
-    if (truncate(file_name.c_str(),0) == -1) {
+    if (ftruncate(fd,0) == -1) {
         error("truncate(clear_file)");
     }
     page_num = 0;
-}
\ No newline at end of file
+}
@@ -7,7 +7,7 @@ Lock::Lock(LockKind lock_kind,int txnid)
      txnid(txnid),
      txnnum(0) {}
 
-Lock::Lock(LockKind lock_kind,int txnnum,const std::set<int>& readers)
+Lock::Lock(LockKind lock_kind,int txnnum,const std::vector<int>& readers)
     :lock_kind(lock_kind),
      txnid(-1),
      txnnum(txnnum),
@@ -29,17 +29,24 @@ bool Lock::has_shared_lock(void) {
     return lock_kind == LockKind::Share;
 }
 
+bool Lock::has_reader(int txnid) {
+    return std::find(readers.begin(),readers.end(),txnid) != readers.end();
+}
+
 void Lock::add_reader(int txnid) {
     assert(lock_kind == LockKind::Share);
     ++txnnum;
-    readers.insert(txnid);
+    readers.push_back(txnid);
     return;
 }
 
 void Lock::delete_reader(int txnid) {
     assert(lock_kind == LockKind::Share);
+    auto it = std::find(readers.begin(),readers.end(),txnid);
+    assert(it != readers.end());
     --txnnum;
-    readers.erase(txnid);
+    *it = readers.back();
+    readers.pop_back();
     return;
 }
 
@@ -59,85 +66,537 @@ bool Lock::has_priority(int txnid_) {
     }
 }
 
+LockKey::LockKey(std::string_view key)
+    :key(key),
+     hash(std::hash<std::string_view>{}(key)) {}
+
+bool lock_mode_compatible(LockMode a,LockMode b) {
+    switch (a) {
+        case LockMode::IS:
+            return b != LockMode::X;
+        case LockMode::IX:
+            return b == LockMode::IS || b == LockMode::IX;
+        case LockMode::S:
+            return b == LockMode::IS || b == LockMode::S;
+        case LockMode::X:
+            return false;
+        default:
+            assert(false);
+    }
+}
+
+// held already grants everything want does
+bool lock_mode_covers(LockMode held,LockMode want) {
+    return held == want || held == LockMode::X || want == LockMode::IS;
+}
+
+// weakest mode granting both
+LockMode lock_mode_combine(LockMode held,LockMode want) {
+    if (lock_mode_covers(held,want)) {
+        return held;
+    } else if (lock_mode_covers(want,held)) {
+        return want;
+    } else {
+        // IX + S
+        return LockMode::X;
+    }
+}
+
+LockManager::LockManager(DeadlockPolicy policy)
+    :partitions(LOCK_PARTITIONS),
+     escalation_threshold(LOCK_ESCALATION_THRESHOLD),
+     policy(policy),
+     stats({0,0,0,0,0,0}) {}
+
+HotKeys::HotKeys()
+    :sample_period(0),
+     grants(0) {}
+
+// conflicts are counted one by one, they already cost a wait or an abort
+KeyContention &HotKeys::entry(std::string_view key) {
+    if (keys.size() >= HOT_KEY_CAPACITY && keys.count(std::string(key)) == 0) {
+        prune();
+    }
+    return keys[std::string(key)];
+}
+
+// one in sample_period grants is counted
+void HotKeys::acquired(std::string_view key) {
+    if (++grants % sample_period == 0) {
+        ++entry(key).acquisitions;
+    }
+}
+
+// drop the less contended half of the keys
+void HotKeys::prune(void) {
+    std::vector<unsigned long long> scores;
+    for (auto &[key,contention] : keys) {
+        scores.push_back(contention.score());
+    }
+    auto median = scores.begin() + scores.size() / 2;
+    std::nth_element(scores.begin(),median,scores.end());
+    unsigned long long threshold = *median;
+    std::erase_if(keys,[threshold](const auto &entry) { return entry.second.score() <= threshold; });
+    if (keys.size() >= HOT_KEY_CAPACITY) {
+        // more than half share the median score
+        keys.clear();
+    }
+}
+
+// ordered by conflicts, then by acquisitions
+std::vector<std::pair<std::string,KeyContention>> HotKeys::top(int n) {
+    std::vector<std::pair<std::string,KeyContention>> ranking(keys.begin(),keys.end());
+    auto hotter = [](const auto &a,const auto &b) {
+        if (a.second.score() != b.second.score()) {
+            return a.second.score() > b.second.score();
+        }
+        if (a.second.acquisitions != b.second.acquisitions) {
+            return a.second.acquisitions > b.second.acquisitions;
+        }
+        return a.first < b.first;
+    };
+    n = std::min(n,(int)ranking.size());
+    std::partial_sort(ranking.begin(),ranking.begin() + n,ranking.end(),hotter);
+    ranking.resize(n);
+    return ranking;
+}
+
+void HotKeys::report(std::ostream &out,int n) {
+    out << std::left << std::setw(24) << "key"
+        << std::setw(14) << "acquisitions"
+        << std::setw(10) << "waits"
+        << std::setw(10) << "aborts"
+        << "upgrade_conflicts" << std::endl;
+    for (auto &[key,contention] : top(n)) {
+        out << std::left << std::setw(24) << key
+            << std::setw(14) << contention.acquisitions * sample_period // estimated from the samples
+            << std::setw(10) << contention.waits
+            << std::setw(10) << contention.aborts
+            << contention.upgrade_conflicts << std::endl;
+    }
+}
+
+LockPartition &LockManager::partition(const LockKey &key) {
+    return partitions[key.hash % LOCK_PARTITIONS];
+}
+
+// number of locked keys
+int LockManager::size(void) {
+    int size = 0;
+    for (auto &partition : partitions) {
+        size += partition.lock_table.size();
+    }
+    return size;
+}
 
 TryLockResult LockManager::try_shared_lock(const std::string& s,int txnid) {
-    if (lock_table.count(s) > 0) {
-        if (lock_table[s].has_exclusive_lock()) {
-            if (lock_table[s].txnid == txnid) {
+    if (!wounded.empty() && wounded.count(txnid) > 0) {
+        ++stats.aborts;
+        return TryLockResult::Abort;
+    }
+    TryLockResult res = try_table_lock(LockMode::IS,txnid);
+    if (res != TryLockResult::GetLock || lock_mode_covers(table_locks[txnid],LockMode::S)) {
+        // waiting for the table, or the table lock covers every key
+        return res;
+    }
+    LockKey key(s);
+    auto &lock_table = partition(key).lock_table;
+    auto it = lock_table.find(key);
+    if (it != lock_table.end()) {
+        Lock &lock = it->second;
+        if (lock.has_exclusive_lock()) {
+            if (lock.txnid == txnid) {
                 return TryLockResult::GetLock;
             }
-            // Wait-Die
-            if (lock_table[s].has_priority(txnid)) {
-                return TryLockResult::Abort;
-            } else {
-                return TryLockResult::Wait;
-            }
+            return conflict(lock,txnid,s);
         } else {
-            assert(lock_table[s].has_shared_lock());
-            if (lock_table[s].readers.count(txnid) == 0) {
-                lock_table[s].add_reader(txnid);
+            assert(lock.has_shared_lock());
+            if (!lock.has_reader(txnid)) {
+                lock.add_reader(txnid);
+                key_granted(txnid,s);
             }
             return TryLockResult::GetLock;
         }
     } else {
-        lock_table[s] = Lock_shared(txnid);
+        lock_table.emplace(LockName{s,key.hash},Lock_shared(txnid));
+        key_granted(txnid,s);
         return TryLockResult::GetLock;
     }
 }
 
 TryLockResult LockManager::try_exclusive_lock(const std::string& s,int txnid) {
-    if (lock_table.count(s) > 0) {
-        if (lock_table[s].has_exclusive_lock() && lock_table[s].txnid == txnid) {
-            return TryLockResult::GetLock;
-        } else if (lock_table[s].has_shared_lock() && lock_table[s].readers.count(txnid) > 0) {
-            return try_upgrade_lock(s,txnid);
+    if (!wounded.empty() && wounded.count(txnid) > 0) {
+        ++stats.aborts;
+        return TryLockResult::Abort;
+    }
+    TryLockResult res = try_table_lock(LockMode::IX,txnid);
+    if (res != TryLockResult::GetLock || table_locks[txnid] == LockMode::X) {
+        return res;
+    }
+    if (!range_locks.empty()) {
+        // a write into a range scanned by another transaction would be a phantom
+        std::vector<int> holders = range_holders(s,txnid);
+        if (!holders.empty()) {
+            return conflict(holders,txnid,s);
         }
-        // Wait-Die
-        if (lock_table[s].has_priority(txnid)) {
-            return TryLockResult::Abort;
-        } else {
-            return TryLockResult::Wait;
+    }
+    LockKey key(s);
+    auto &lock_table = partition(key).lock_table;
+    auto it = lock_table.find(key);
+    if (it != lock_table.end()) {
+        Lock &lock = it->second;
+        if (lock.has_exclusive_lock() && lock.txnid == txnid) {
+            return TryLockResult::GetLock;
+        } else if (lock.has_shared_lock() && lock.has_reader(txnid)) {
+            return upgrade(lock,txnid,s);
         }
+        return conflict(lock,txnid,s);
     } else {
-        lock_table[s] = Lock_exclusive(txnid);
+        lock_table.emplace(LockName{s,key.hash},Lock_exclusive(txnid));
+        key_granted(txnid,s);
         return TryLockResult::GetLock;
     }
 }
 
 TryLockResult LockManager::try_upgrade_lock(const std::string& s,int txnid) {
-    assert(lock_table.count(s) > 0 && lock_table[s].has_shared_lock() && lock_table[s].readers.count(txnid) > 0);
-    if (lock_table[s].readers.size() == 1) {
-        lock_table[s] = Lock_exclusive(txnid);
+    TryLockResult res = try_table_lock(LockMode::IX,txnid);
+    if (res != TryLockResult::GetLock || table_locks[txnid] == LockMode::X) {
+        return res;
+    }
+    if (!range_locks.empty()) {
+        std::vector<int> holders = range_holders(s,txnid);
+        if (!holders.empty()) {
+            return conflict(holders,txnid,s);
+        }
+    }
+    LockKey key(s);
+    auto &lock_table = partition(key).lock_table;
+    auto it = lock_table.find(key);
+    if (it == lock_table.end()) {
+        // the shared lock was escalated to a table S lock, which the IX above turned into X
+        return TryLockResult::GetLock;
+    }
+    return upgrade(it->second,txnid,s);
+}
+
+TryLockResult LockManager::upgrade(Lock &lock,int txnid,std::string_view key) {
+    assert(lock.has_shared_lock() && lock.has_reader(txnid));
+    if (lock.readers.size() == 1) {
+        lock = Lock_exclusive(txnid);
+        granted(txnid);
+        if (hot_keys.sample_period > 0) {
+            hot_keys.acquired(key);
+        }
         return TryLockResult::GetLock;
     } else {
-        // Wait-Die
-        if (lock_table[s].has_priority(txnid)) {
-            return TryLockResult::Abort;
+        if (hot_keys.sample_period > 0) {
+            ++hot_keys.entry(key).upgrade_conflicts;
+        }
+        return conflict(lock,txnid,key);
+    }
+}
+
+// txnid cannot get lock now, the deadlock policy decides whether it waits
+TryLockResult LockManager::conflict(Lock &lock,int txnid,std::string_view key) {
+    std::vector<int> holders;
+    if (lock.has_exclusive_lock()) {
+        holders.push_back(lock.txnid);
+    } else {
+        for (int reader : lock.readers) {
+            if (reader != txnid) {
+                holders.push_back(reader);
+            }
+        }
+    }
+    return conflict(holders,txnid,key);
+}
+
+// key is "" for table locks and range locks
+TryLockResult LockManager::conflict(const std::vector<int> &holders,int txnid,std::string_view key) {
+    bool abort = false;
+    switch (policy) {
+        case DeadlockPolicy::WaitDie:
+            for (int holder : holders) {
+                abort |= holder < txnid;
+            }
+            break;
+        case DeadlockPolicy::WoundWait:
+            for (int holder : holders) {
+                if (txnid < holder && wounded.insert(holder).second) {
+                    ++stats.wounds;
+                    // a wounded holder that is waiting itself must wake up to abort
+                    wake(holder);
+                }
+            }
+            break;
+        case DeadlockPolicy::Detection:
+            waits_for[txnid] = holders;
+            if (closes_cycle(txnid)) {
+                waits_for.erase(txnid);
+                ++stats.deadlocks;
+                abort = true;
+            }
+            break;
+        default:
+            assert(false);
+    }
+
+    if (hot_keys.sample_period > 0 && !key.empty()) {
+        KeyContention &contention = hot_keys.entry(key);
+        ++(abort ? contention.aborts : contention.waits);
+    }
+
+    if (abort) {
+        ++stats.aborts;
+        return TryLockResult::Abort;
+    } else {
+        ++stats.waits;
+        for (int holder : holders) {
+            waiters[holder].push_back(txnid);
+        }
+        return TryLockResult::Wait;
+    }
+}
+
+// true if txnid is reachable from itself in the waits-for graph
+bool LockManager::closes_cycle(int txnid) {
+    std::vector<int> stack = waits_for[txnid];
+    std::set<int> visited;
+    while (!stack.empty()) {
+        int t = stack.back();
+        stack.pop_back();
+        if (t == txnid) {
+            return true;
+        }
+        if (!visited.insert(t).second) {
+            continue;
+        }
+        auto it = waits_for.find(t);
+        if (it != waits_for.end()) {
+            stack.insert(stack.end(),it->second.begin(),it->second.end());
+        }
+    }
+    return false;
+}
+
+void LockManager::granted(int txnid) {
+    ++stats.acquisitions;
+    if (policy == DeadlockPolicy::Detection) {
+        waits_for.erase(txnid);
+    }
+}
+
+// txnid got Wait and its coroutine suspended
+void LockManager::block(int txnid,std::coroutine_handle<> handle,std::function<TryLockResult()> try_lock) {
+    blocked[txnid] = BlockedRequest{handle,std::move(try_lock)};
+}
+
+void LockManager::unblock(int txnid) {
+    blocked.erase(txnid);
+    woken.erase(txnid);
+}
+
+void LockManager::wake(int txnid) {
+    if (blocked.count(txnid) > 0) {
+        woken.insert(txnid);
+    }
+}
+
+// try the requests of the woken transactions again. a granted or aborted
+// request moves its coroutine to runnable, one that has to wait stays blocked.
+// an abort finishes the transaction and may wake more
+void LockManager::grant_woken(void) {
+    while (!woken.empty()) {
+        int txnid = *woken.begin();
+        woken.erase(woken.begin());
+        auto it = blocked.find(txnid);
+        if (it == blocked.end()) {
+            continue;
+        }
+        BlockedRequest request = std::move(it->second);
+        blocked.erase(it);
+        TryLockResult res = request.try_lock();
+        if (res == TryLockResult::Wait) {
+            blocked.emplace(txnid,std::move(request));
         } else {
-            return TryLockResult::Wait;
+            runnable.emplace_back(request.handle,res);
         }
     }
 }
 
+// a new key lock, too many of them are traded for one table lock
+void LockManager::key_granted(int txnid,std::string_view key) {
+    granted(txnid);
+    if (hot_keys.sample_period > 0) {
+        hot_keys.acquired(key);
+    }
+    if (++key_locks[txnid] > escalation_threshold) {
+        escalate(txnid);
+    }
+}
+
+// mode txnid holds on the table
+std::optional<LockMode> LockManager::table_lock(int txnid) {
+    auto it = table_locks.find(txnid);
+    if (it == table_locks.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
 
-void LockManager::unlock(const std::string& s,int txnid) {
-    assert(lock_table.count(s) > 0);
-    switch (lock_table[s].lock_kind) {
+// bulk operations lock the table once instead of every key.
+// key requests take IS or IX here first, the table has a single lock so
+// the holders are checked one by one.
+TryLockResult LockManager::try_table_lock(LockMode mode,int txnid) {
+    if (!wounded.empty() && wounded.count(txnid) > 0) {
+        ++stats.aborts;
+        return TryLockResult::Abort;
+    }
+    std::optional<LockMode> held = table_lock(txnid);
+    if (held && lock_mode_covers(held.value(),mode)) {
+        return TryLockResult::GetLock;
+    }
+    LockMode want = held ? lock_mode_combine(held.value(),mode) : mode;
+    std::vector<int> holders;
+    for (auto [holder,holder_mode] : table_locks) {
+        if (holder != txnid && !lock_mode_compatible(want,holder_mode)) {
+            holders.push_back(holder);
+        }
+    }
+    if (!holders.empty()) {
+        return conflict(holders,txnid);
+    }
+    table_locks[txnid] = want;
+    granted(txnid);
+    return TryLockResult::GetLock;
+}
+
+// replace txnid's key locks with S or X on the table.
+// never waits, if another transaction is in the way txnid keeps its key locks.
+void LockManager::escalate(int txnid) {
+    LockMode mode = table_locks[txnid] == LockMode::IS ? LockMode::S : LockMode::X;
+    for (auto [holder,holder_mode] : table_locks) {
+        if (holder != txnid && !lock_mode_compatible(mode,holder_mode)) {
+            key_locks[txnid] = 0; // try again after another threshold
+            return;
+        }
+    }
+    table_locks[txnid] = mode;
+    key_locks[txnid] = 0;
+    ++stats.escalations;
+    for (auto &partition : partitions) {
+        auto &lock_table = partition.lock_table;
+        for (auto it = lock_table.begin(); it != lock_table.end(); ) {
+            Lock &lock = it->second;
+            if (lock.has_exclusive_lock() && lock.txnid == txnid) {
+                it = lock_table.erase(it);
+                continue;
+            } else if (lock.has_shared_lock() && lock.has_reader(txnid)) {
+                lock.delete_reader(txnid);
+                if (lock.txnnum == 0) {
+                    it = lock_table.erase(it);
+                    continue;
+                }
+            }
+            ++it;
+        }
+    }
+    if (!range_locks.empty()) {
+        std::erase_if(range_locks,[txnid](const RangeLock &range_lock) { return range_lock.txnid == txnid; });
+    }
+}
+
+// shared lock on every key in [low,high), including keys inserted later.
+// conflicts with exclusive key locks of other transactions inside the range,
+// finding them costs a pass over the held locks, which only scans pay.
+TryLockResult LockManager::try_range_lock(const std::string& low,const std::string& high,int txnid) {
+    if (!wounded.empty() && wounded.count(txnid) > 0) {
+        ++stats.aborts;
+        return TryLockResult::Abort;
+    }
+    TryLockResult res = try_table_lock(LockMode::IS,txnid);
+    if (res != TryLockResult::GetLock || lock_mode_covers(table_locks[txnid],LockMode::S)) {
+        return res;
+    }
+    for (auto &range_lock : range_locks) {
+        if (range_lock.txnid == txnid && range_lock.low <= low && high <= range_lock.high) {
+            return TryLockResult::GetLock;
+        }
+    }
+    std::vector<int> holders;
+    for (auto &partition : partitions) {
+        for (auto &[name,lock] : partition.lock_table) {
+            if (lock.has_exclusive_lock() && lock.txnid != txnid && low <= name.key && name.key < high) {
+                holders.push_back(lock.txnid);
+            }
+        }
+    }
+    if (!holders.empty()) {
+        return conflict(holders,txnid);
+    }
+    range_locks.push_back(RangeLock{low,high,txnid});
+    granted(txnid);
+    return TryLockResult::GetLock;
+}
+
+// transactions other than txnid holding a range lock that covers s
+std::vector<int> LockManager::range_holders(const std::string& s,int txnid) {
+    std::vector<int> holders;
+    for (auto &range_lock : range_locks) {
+        if (range_lock.txnid != txnid && range_lock.low <= s && s < range_lock.high) {
+            holders.push_back(range_lock.txnid);
+        }
+    }
+    return holders;
+}
+
+void LockManager::unlock(std::string_view s,int txnid) {
+    LockKey key(s);
+    auto &lock_table = partition(key).lock_table;
+    auto it = lock_table.find(key);
+    if (it == lock_table.end()) {
+        // covered by a table lock, or released when it was escalated
+        assert(!table_locks.empty());
+        return;
+    }
+    Lock &lock = it->second;
+    switch (lock.lock_kind) {
         case LockKind::Share:
-            assert(lock_table[s].readers.count(txnid) > 0);
-            lock_table[s].delete_reader(txnid);
-            if (lock_table[s].txnnum == 0) {
-                lock_table.erase(s);
+            if (!lock.has_reader(txnid)) {
+                assert(table_lock(txnid));
+                return;
+            }
+            lock.delete_reader(txnid);
+            if (lock.txnnum == 0) {
+                lock_table.erase(it);
             }
             break;
         case LockKind::Exclusive:
-            assert(lock_table[s].txnid == txnid);
-            lock_table.erase(s);
+            if (lock.txnid != txnid) {
+                assert(table_lock(txnid));
+                return;
+            }
+            lock_table.erase(it);
             break;
         default:
             assert(false);
     }
 }
 
-
-
+// txnid committed or aborted
+void LockManager::finish(int txnid) {
+    unblock(txnid);
+    if (auto it = waiters.find(txnid); it != waiters.end()) {
+        for (int waiter : it->second) {
+            wake(waiter);
+        }
+        waiters.erase(it);
+    }
+    table_locks.erase(txnid);
+    key_locks.erase(txnid);
+    wounded.erase(txnid);
+    waits_for.erase(txnid);
+    if (!range_locks.empty()) {
+        std::erase_if(range_locks,[txnid](const RangeLock &range_lock) { return range_lock.txnid == txnid; });
+    }
+}
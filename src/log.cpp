@@ -1,12 +1,14 @@
 #include "db.hpp"
 
 LogManager::LogManager(std::string log_file_name) 
-    :log_file_name(log_file_name) 
+    :log_file_name(log_file_name),
+     lsn(0)
 {
     log_file_output.open(log_file_name,std::ios::app);
     if (!log_file_output) {
         error("open(log_file)");
     }
+    empty = file_size(log_file_name) == 0;
 }
 
 LogManager::~LogManager() {
@@ -16,11 +18,13 @@ LogManager::~LogManager() {
 // write (insert,update) log
 // w crc32(key+value) sizeof(key)+sizeof(value) key value
 // example) w (0x)12345678 (0x)18 aaa bbb 
-void LogManager::log(LogKind log_kind,const std::string &key,const std::string &value) {
+void LogManager::log(LogKind log_kind,std::string_view key,std::string_view value) {
     unsigned int key_size = key.size();
     unsigned int value_size = value.size();
-    std::string key_value_size = to_hex(key_size) + to_hex(value_size);
-    unsigned int check_sum = crc32(key_value_size+key+value);
+    std::string key_value = to_hex(key_size) + to_hex(value_size);
+    key_value += key;
+    key_value += value;
+    unsigned int check_sum = crc32(key_value);
     std::string buf = "";
 
     buf += LogKind2str(log_kind); // insert "i"
@@ -28,15 +32,19 @@ void LogManager::log(LogKind log_kind,const std::string &key,const std::string &
                                   // del    "d"
                                   // commit "c"
     buf += to_hex(check_sum);     // 8
-    buf += key_value_size;        // 16
-    buf += key;
-    buf += value;
+    buf += key_value;             // 16 + key + value
 
+    auto start = std::chrono::steady_clock::now();
     log_file_output << buf;
+    lsn += buf.size();
+    empty = false;
+    io_stats.add_write(buf.size(),elapsed_us(start));
 }
 
 void LogManager::log_flush() {
+    auto start = std::chrono::steady_clock::now();
     log_file_output << std::flush;
+    io_stats.add_sync(elapsed_us(start));
 }
 
 //logを消す
@@ -46,6 +54,7 @@ void LogManager::erase_log() {
     if (!log_file_output) {
         error("open(log_file");
     }
+    empty = true;
 }
 
 std::string LogKind2str(LogKind log_kind) {
@@ -57,6 +66,8 @@ std::string LogKind2str(LogKind log_kind) {
         return "d";
     } else if (log_kind == LogKind::commit) {
         return "c";
+    } else if (log_kind == LogKind::abort) {
+        return "a";
     }
     error("LogKind2str");
     return "";
@@ -0,0 +1,277 @@
+#include "db.hpp"
+#include <chrono>
+#include <random>
+
+// hot paths of each component measured in isolation, in ns per operation.
+//
+// usage: ./micro_bench [--filter=name] [--min-time=0.2] [--save=file]
+//                      [--compare=file] [--threshold=10]
+//
+// --filter runs the benchmarks whose name contains it, --save writes the
+// results as a baseline, --compare prints the change against one and exits
+// with 1 if any benchmark is more than threshold % slower.
+
+struct MicroResult {
+    std::string name;
+    double ns_per_op;
+    long iterations;
+};
+
+// body(n) performs n operations. n doubles until one run takes min_time,
+// the best of three such runs is reported. reset() runs untimed before each run.
+template<class Body,class Reset>
+MicroResult measure(const std::string &name,double min_time,Body &&body,Reset &&reset) {
+    long iterations = 1;
+    double seconds = 0;
+    while (true) {
+        reset();
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        auto end = std::chrono::steady_clock::now();
+        seconds = std::chrono::duration<double>(end - start).count();
+        if (seconds >= min_time || iterations >= (1L << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+    double best = seconds;
+    for (int i = 0;i < 2; i++) {
+        reset();
+        auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best,std::chrono::duration<double>(end - start).count());
+    }
+    return MicroResult{name,best * 1e9 / iterations,iterations};
+}
+
+template<class Body>
+MicroResult measure(const std::string &name,double min_time,Body &&body) {
+    return measure(name,min_time,std::forward<Body>(body),[]{});
+}
+
+// number of nodes on a root-to-leaf path
+int btree_height(BTree &btree) {
+    int height = 1;
+    Node node = *btree.root;
+    while (!node.is_leaf()) {
+        node = Node(&btree.buffer_manager,node.child_pageid(0));
+        ++height;
+    }
+    return height;
+}
+
+std::vector<MicroResult> run_benchmarks(const std::string &filter,double min_time) {
+    std::vector<MicroResult> results;
+    // filter matches benchmark names, a group is set up when any of its benchmarks is selected
+    auto selected = [&](const std::string &name) {
+        return name.find(filter) != std::string::npos;
+    };
+    auto add = [&](const MicroResult &result) {
+        if (selected(result.name)) {
+            results.push_back(result);
+        }
+    };
+    std::mt19937_64 rnd(0);
+
+    if (selected("node_search") || selected("node_search_per_level")) {
+        std::string file_name = "micro_bench_btree.txt";
+        remove(file_name.c_str());
+        {
+            const int keys = 20000;
+            BTree btree(file_name);
+            for (int i = 0;i < keys; i++) {
+                btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+            }
+            std::vector<std::string> probes;
+            std::uniform_int_distribution<int> dist(0,keys - 1);
+            for (int i = 0;i < 1024; i++) {
+                probes.push_back("key" + std::to_string(dist(rnd)));
+            }
+            MicroResult result = measure("node_search",min_time,[&](long n) {
+                for (long i = 0;i < n; i++) {
+                    auto value = btree.search(probes[i & 1023]);
+                    assert(value);
+                    (void)value;
+                }
+            });
+            add(result);
+            int height = btree_height(btree);
+            add(MicroResult{"node_search_per_level",result.ns_per_op / height,result.iterations * height});
+        }
+        remove(file_name.c_str());
+    }
+
+    if (selected("buffer_fetch_hit") || selected("buffer_fetch_miss") || selected("buffer_fetch_readahead")) {
+        std::string file_name = "micro_bench_buffer.txt";
+        remove(file_name.c_str());
+        {
+            BufferManager buffer_manager(file_name);
+            const int pages = 2 * MAX_BUFFER_SIZE;
+            for (int i = 0;i < pages; i++) {
+                buffer_manager.create_new_page();
+            }
+            if (selected("buffer_fetch_hit")) {
+                // a working set well inside the pool
+                for (int i = 0;i < 64; i++) {
+                    buffer_manager.fetch_page(i);
+                }
+                add(measure("buffer_fetch_hit",min_time,[&](long n) {
+                    for (long i = 0;i < n; i++) {
+                        buffer_manager.fetch_page(i & 63);
+                    }
+                }));
+            }
+            int readahead_pages = buffer_manager.readahead_pages;
+            if (selected("buffer_fetch_miss")) {
+                // a sequential sweep over twice the pool misses on every page
+                // as long as read-ahead does not bring the next pages in
+                buffer_manager.readahead_pages = 0;
+                long next = 0;
+                add(measure("buffer_fetch_miss",min_time,[&](long n) {
+                    for (long i = 0;i < n; i++) {
+                        buffer_manager.fetch_page(next++ % pages);
+                    }
+                }));
+                buffer_manager.readahead_pages = readahead_pages;
+            }
+            if (selected("buffer_fetch_readahead")) {
+                // the same sweep, read-ahead turns most of it into hits
+                long next = 0;
+                add(measure("buffer_fetch_readahead",min_time,[&](long n) {
+                    for (long i = 0;i < n; i++) {
+                        buffer_manager.fetch_page(next++ % pages);
+                    }
+                }));
+            }
+        }
+        remove(file_name.c_str());
+    }
+
+    if (selected("log_append")) {
+        std::string file_name = "micro_bench_log.txt";
+        remove(file_name.c_str());
+        {
+            LogManager log_manager(file_name);
+            std::string key = "key12345";
+            std::string value(100,'v');
+            add(measure("log_append",min_time,[&](long n) {
+                for (long i = 0;i < n; i++) {
+                    log_manager.log(LogKind::update,key,value);
+                }
+            },[&]{
+                // keeps the file small, untimed
+                log_manager.erase_log();
+            }));
+        }
+        remove(file_name.c_str());
+    }
+
+    if (selected("lock_exclusive_unlock")) {
+        LockManager lock_manager;
+        std::vector<std::string> keys;
+        for (int i = 0;i < 1024; i++) {
+            keys.push_back("key" + std::to_string(i));
+        }
+        add(measure("lock_exclusive_unlock",min_time,[&](long n) {
+            for (long i = 0;i < n; i++) {
+                TryLockResult res = lock_manager.try_exclusive_lock(keys[i & 1023],1);
+                assert(res == TryLockResult::GetLock);
+                (void)res;
+                lock_manager.unlock(keys[i & 1023],1);
+            }
+        }));
+        lock_manager.finish(1);
+    }
+
+    return results;
+}
+
+std::map<std::string,double> load_baseline(const std::string &file_name) {
+    std::map<std::string,double> baseline;
+    std::ifstream file(file_name);
+    if (!file) {
+        error("ifstream(baseline)");
+    }
+    std::string name;
+    double ns_per_op;
+    while (file >> name >> ns_per_op) {
+        baseline[name] = ns_per_op;
+    }
+    return baseline;
+}
+
+int main(int argc,char *argv[]) {
+    std::string filter = "";
+    double min_time = 0.2;
+    std::string save_file = "";
+    std::string compare_file = "";
+    double threshold = 10;
+    for (int i = 1;i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0,eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--filter") {
+            filter = value;
+        } else if (name == "--min-time") {
+            min_time = atof(value.c_str());
+        } else if (name == "--save") {
+            save_file = value;
+        } else if (name == "--compare") {
+            compare_file = value;
+        } else if (name == "--threshold") {
+            threshold = atof(value.c_str());
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::map<std::string,double> baseline;
+    if (compare_file != "") {
+        baseline = load_baseline(compare_file);
+    }
+
+    std::vector<MicroResult> results = run_benchmarks(filter,min_time);
+
+    bool regression = false;
+    std::cout << std::left << std::setw(24) << "benchmark"
+              << std::setw(14) << "ns/op"
+              << std::setw(14) << "iterations";
+    if (compare_file != "") {
+        std::cout << std::setw(14) << "baseline" << "change";
+    }
+    std::cout << std::endl;
+    for (auto &result : results) {
+        std::cout << std::left << std::setw(24) << result.name
+                  << std::setw(14) << std::fixed << std::setprecision(1) << result.ns_per_op
+                  << std::setw(14) << result.iterations;
+        if (compare_file != "") {
+            auto it = baseline.find(result.name);
+            if (it == baseline.end()) {
+                std::cout << std::setw(14) << "-" << "new";
+            } else {
+                double change = (result.ns_per_op / it->second - 1) * 100;
+                std::cout << std::setw(14) << it->second
+                          << std::showpos << change << "%" << std::noshowpos;
+                if (change > threshold) {
+                    std::cout << "  REGRESSION";
+                    regression = true;
+                }
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    if (save_file != "") {
+        std::ofstream file(save_file);
+        if (!file) {
+            error("ofstream(baseline)");
+        }
+        for (auto &result : results) {
+            file << result.name << " " << std::fixed << std::setprecision(1) << result.ns_per_op << std::endl;
+        }
+    }
+    return regression ? 1 : 0;
+}
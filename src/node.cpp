@@ -84,25 +84,65 @@ void Node::set_child_pageid(int index,int child_pageid) {
                                                                +index*(pageid_len + key_len + value_len),pageid_len);
 }
 
-void Node::set_keys(int index,const std::string &key) {
+void Node::set_keys(int index,std::string_view key) {
     unsigned int key_size = key.size();
-    std::string key_size_str = to_hex(key_size);
-    std::string key_buf = key_size_str + key;
+    std::string key_buf = to_hex(key_size);
+    key_buf.append(key);
     assert((int)key_buf.size() <= key_len);
     buffer_manager->write_page(pageid,key_buf.c_str(), checksum_len + is_leaf_len + keys_size_len + pageid_len
                                                       +index*(pageid_len + key_len + value_len),key_buf.size());
 }
 
-void Node::set_values(int index,const std::string &value) {
+void Node::set_values(int index,std::string_view value) {
     unsigned int value_size = value.size();
-    std::string value_size_str = to_hex(value_size);
-    std::string value_buf = value_size_str + value;
+    std::string value_buf = to_hex(value_size);
+    value_buf.append(value);
     assert((int)value_buf.size() <= value_len);
     buffer_manager->write_page(pageid,value_buf.c_str(), checksum_len + is_leaf_len + keys_size_len + pageid_len + key_len
                                                         +index*(pageid_len + key_len + value_len),value_buf.size());
 }
 
-std::optional<std::string> Node::search(const std::string &key) {
+static int hex_field(const char *buf,int len) {
+    std::string field(buf,len);
+    return strtol(field.c_str(),NULL,16);
+}
+
+NodeImage Node::load(void) {
+    const char *buf = buffer_manager->read_page(pageid,checksum_len,PAGESIZE - checksum_len);
+    // offsets below are relative to the end of the checksum
+    NodeImage image;
+    image.is_leaf = buf[0] == '1';
+    image.keys_size = hex_field(buf + is_leaf_len,keys_size_len);
+    int slot = is_leaf_len + keys_size_len;
+    for(int i = 0;i < image.keys_size; i++) {
+        const char *key_buf = buf + slot + i * (pageid_len + key_len + value_len) + pageid_len;
+        const char *value_buf = key_buf + key_len;
+        image.keys.emplace_back(key_buf + keysize_len,hex_field(key_buf,keysize_len));
+        image.values.emplace_back(value_buf + valuesize_len,hex_field(value_buf,valuesize_len));
+    }
+    if (!image.is_leaf) {
+        for(int i = 0;i <= image.keys_size; i++) {
+            image.children.push_back(hex_field(buf + slot + i * (pageid_len + key_len + value_len),pageid_len));
+        }
+    }
+    free(const_cast<char*>(buf));
+    return image;
+}
+
+bool NodeImage::isfull(void) const {
+    return keys_size == order - 1;
+}
+
+int NodeImage::lower_bound(std::string_view key) const {
+    for(int i = 0;i < keys_size; i++) {
+        if (key <= keys[i]) {
+            return i;
+        }
+    }
+    return keys_size;
+}
+
+std::optional<std::string> Node::search(std::string_view key) {
     for (int i = 0;i < keys_size(); i++) {
         if (key == keys(i)) {
             return values(i);
@@ -120,7 +160,7 @@ std::optional<std::string> Node::search(const std::string &key) {
     return Node(buffer_manager,child_pageid(index)).search(key);
 }
 
-bool Node::update(const std::string &key,const std::string &value) {
+bool Node::update(std::string_view key,const std::string &value) {
     for (int i = 0;i < keys_size(); i++) {
         if (key == keys(i)) {
             set_values(i,value);
@@ -139,36 +179,56 @@ bool Node::update(const std::string &key,const std::string &value) {
     return Node(buffer_manager,child_pageid(index)).update(key,value);
 }
 
-void Node::insert(const std::string &key,const std::string &value) {
-    assert(!isfull());
-    int idx = keys_size();
-    for(int i = 0;i < keys_size(); i++) {
-        if (key <= keys(i)) {
-            assert(key != keys(i));
-            idx = i;
-            break;
-        }
-    }
-    if (is_leaf()) {
-        for(int i = keys_size() - 1;i >= idx; i--) {
-            set_keys(i+1,keys(i));
-            set_values(i+1,values(i));
+void Node::insert(std::string_view key,std::string_view value) {
+    insert(key,value,load());
+}
+
+void Node::insert(std::string_view key,std::string_view value,NodeImage image) {
+    auto old_value = upsert(key,value,std::move(image));
+    assert(!old_value);
+    (void)old_value;
+}
+
+// top-down single pass: every page on the root-to-leaf path is read once,
+// full children are split on the way down using the images already in hand.
+// an existing key is overwritten where it is found, its old value is returned.
+std::optional<std::string> Node::upsert(std::string_view key,std::string_view value,NodeImage image) {
+    assert(!image.isfull());
+    Node node = *this;
+    int idx = image.lower_bound(key);
+    while (idx == image.keys_size || image.keys[idx] != key) {
+        if (image.is_leaf) {
+            for(int i = image.keys_size - 1;i >= idx; i--) {
+                node.set_keys(i+1,image.keys[i]);
+                node.set_values(i+1,image.values[i]);
+            }
+            node.set_keys(idx,key);
+            node.set_values(idx,value);
+            node.set_keys_size(image.keys_size + 1);
+            return std::nullopt;
         }
-        set_keys(idx,key);
-        set_values(idx,value);
-        set_keys_size(keys_size() + 1);
-    } else {
-        if (Node(buffer_manager,child_pageid(idx)).isfull()) {
-            splitchild(idx);
-            if (keys(idx) < key) {
-                idx++;
+        Node child(buffer_manager,image.children[idx]);
+        NodeImage child_image = child.load();
+        if (child_image.isfull()) {
+            NodeImage sibling_image = node.splitchild(idx,image,child_image);
+            if (image.keys[idx] == key) {
+                // the split pulled key up into node
+                break;
+            } else if (image.keys[idx] < key) {
+                child = Node(buffer_manager,image.children[idx+1]);
+                child_image = std::move(sibling_image);
             }
         }
-        Node(buffer_manager,child_pageid(idx)).insert(key,value);
+        node = child;
+        image = std::move(child_image);
+        idx = image.lower_bound(key);
     }
+    std::optional<std::string> old_value = std::move(image.values[idx]);
+    node.set_values(idx,value);
+    return old_value;
 }
 
-bool Node::del(const std::string &key) {
+std::optional<std::string> Node::erase(std::string_view key) {
     if (is_leaf()) {
         int index = -1;
         int node_keys_size = keys_size();
@@ -179,14 +239,15 @@ bool Node::del(const std::string &key) {
             }
         }
         if (index == -1) {
-            return false;
+            return std::nullopt;
         } else {
+            std::optional<std::string> old_value = values(index);
             for(int i = index + 1;i < node_keys_size; i++) {
                 set_keys(i-1,keys(i));
                 set_values(i-1,values(i));
             }
             set_keys_size(node_keys_size - 1);
-            return true;
+            return old_value;
         }
     } else {
         int index = keys_size();
@@ -196,18 +257,13 @@ bool Node::del(const std::string &key) {
                 Node child1(buffer_manager,child_pageid(i+1));
                 if (child0.keys_size() + child1.keys_size() + 1 < order) {
                     merge(i);
-                    return child0.del(key);
-                } else if (child0.keys_size() > halforder) {
-                    auto data = child0.delete_max_data();
-                    set_keys(i,data.first);
-                    set_values(i,data.second);
-                    return true;
-                } else {
-                    auto data = child1.delete_min_data();
-                    set_keys(i,data.first);
-                    set_values(i,data.second);
-                    return true;
+                    return child0.erase(key);
                 }
+                std::optional<std::string> old_value = values(i);
+                auto data = child0.keys_size() > halforder ? child0.delete_max_data() : child1.delete_min_data();
+                set_keys(i,data.first);
+                set_values(i,data.second);
+                return old_value;
             } else if(key < keys(i)) {
                 index = i;
                 break;
@@ -229,43 +285,70 @@ bool Node::del(const std::string &key) {
                 }
             }
         }
-        return Node(buffer_manager,child_pageid(index)).del(key);
+        return Node(buffer_manager,child_pageid(index)).erase(key);
     }
 }
 
 void Node::splitchild(int idx) {
-    assert(!isfull());
-    assert(Node(buffer_manager,child_pageid(idx)).isfull());
-    Node child = Node(buffer_manager,child_pageid(idx));
-    std::string key   = child.keys(halforder);
-    std::string value = child.values(halforder); 
-
-    for(int i = keys_size() - 1;i >= idx; i--) {
-        set_keys(i+1,keys(i));
-        set_values(i+1,values(i));
+    NodeImage image = load();
+    NodeImage child_image = Node(buffer_manager,image.children[idx]).load();
+    splitchild(idx,image,child_image);
+}
+
+// split the full child at idx.
+// image and child_image are kept in sync with what is written to the pages,
+// the image of the new right sibling is returned.
+NodeImage Node::splitchild(int idx,NodeImage &image,NodeImage &child_image) {
+    assert(!image.isfull());
+    assert(child_image.isfull());
+    Node child = Node(buffer_manager,image.children[idx]);
+    std::string key   = child_image.keys[halforder];
+    std::string value = child_image.values[halforder];
+
+    for(int i = image.keys_size - 1;i >= idx; i--) {
+        set_keys(i+1,image.keys[i]);
+        set_values(i+1,image.values[i]);
     }
     set_keys(idx,key);
     set_values(idx,value);
 
-    for(int i = keys_size();i >= idx; i--) {
-        set_child_pageid(i+1,child_pageid(i));
+    for(int i = image.keys_size;i > idx; i--) {
+        set_child_pageid(i+1,image.children[i]);
     }
-    set_keys_size(keys_size() + 1);
+    set_keys_size(image.keys_size + 1);
 
-    int new_pageid = buffer_manager->create_new_page();
+    int new_pageid = buffer_manager->allocate_page();
     Node node = Node(buffer_manager,new_pageid);
-    node.set_is_leaf(Node(buffer_manager,child_pageid(idx)).is_leaf());
+    NodeImage node_image;
+    node_image.is_leaf = child_image.is_leaf;
+    node_image.keys_size = halforder;
+    node_image.keys.assign(child_image.keys.begin() + halforder + 1,child_image.keys.end());
+    node_image.values.assign(child_image.values.begin() + halforder + 1,child_image.values.end());
+    node.set_is_leaf(node_image.is_leaf);
     for(int i = 0;i < halforder; i++) {
-        node.set_keys(i,child.keys(i + halforder + 1));
-        node.set_values(i,child.values(i + halforder + 1));
+        node.set_keys(i,node_image.keys[i]);
+        node.set_values(i,node_image.values[i]);
     }
-    for(int i = 0;i < halforder + 1; i++) {
-        node.set_child_pageid(i,child.child_pageid(i + halforder + 1));
+    if (!child_image.is_leaf) {
+        node_image.children.assign(child_image.children.begin() + halforder + 1,child_image.children.end());
+        for(int i = 0;i < halforder + 1; i++) {
+            node.set_child_pageid(i,node_image.children[i]);
+        }
+        child_image.children.resize(halforder + 1);
     }
     node.set_keys_size(halforder);
 
     set_child_pageid(idx+1,node.pageid);
     child.set_keys_size(halforder);
+
+    image.keys.insert(image.keys.begin() + idx,key);
+    image.values.insert(image.values.begin() + idx,value);
+    image.children.insert(image.children.begin() + idx + 1,node.pageid);
+    ++image.keys_size;
+    child_image.keys.resize(halforder);
+    child_image.values.resize(halforder);
+    child_image.keys_size = halforder;
+    return node_image;
 }
 
 void Node::leftshift(int index) {
@@ -348,12 +431,12 @@ void Node::merge(int index) {
     }
     set_keys_size(node_keys_size - 1);
 
-    // we don't use child1' page from now on
+    buffer_manager->free_page(child1.pageid);
 }
 
 std::pair<std::string,std::string> Node::delete_max_data(void) {
     auto data = max_data();
-    del(data.first);
+    erase(data.first);
     return data;
 }
 
@@ -368,7 +451,7 @@ std::pair<std::string,std::string> Node::max_data(void) {
 
 std::pair<std::string,std::string> Node::delete_min_data(void) {
     auto data = min_data();
-    del(data.first);
+    erase(data.first);
     return data;
 }
 
@@ -384,26 +467,46 @@ bool Node::isfull() {
     return keys_size() == order - 1;
 }
 
-std::map<std::string,std::string> Node::all_data(void) {
-    std::map<std::string,std::string> all_datas;
-    if (is_leaf()) {
-        for (int i = 0;i < keys_size(); i++) {
-            all_datas[keys(i)] = values(i);
+// low <= key < high のデータを集める。範囲外の子はたどらない。
+void Node::range(const std::string &low,const std::string &high,std::map<std::string,std::string> &datas) {
+    NodeImage image = load();
+    int n = image.keys_size;
+    for (int i = 0;i < n; i++) {
+        if (low <= image.keys[i] && image.keys[i] < high) {
+            datas[image.keys[i]] = image.values[i];
         }
-        return all_datas;
-    } else {
-        for (int i = 0;i < keys_size(); i++) {
-            all_datas[keys(i)] = values(i);
+    }
+    if (image.is_leaf) return;
+    // child i holds keys between keys[i-1] and keys[i]
+    std::vector<int> children;
+    for (int i = 0;i <= n; i++) {
+        if ((i == 0 || image.keys[i - 1] < high) && (i == n || low < image.keys[i])) {
+            children.push_back(image.children[i]);
         }
-        for (int i = 0;i <= keys_size(); i++) {
-            auto child_datas = Node(buffer_manager,child_pageid(i)).all_data();
+    }
+    buffer_manager->read_ahead(children);
+    for (int child : children) {
+        Node(buffer_manager,child).range(low,high,datas);
+    }
+}
+
+std::map<std::string,std::string> Node::all_data(void) {
+    NodeImage image = load();
+    std::map<std::string,std::string> all_datas;
+    for (int i = 0;i < image.keys_size; i++) {
+        all_datas[image.keys[i]] = image.values[i];
+    }
+    if (!image.is_leaf) {
+        // the children are read in as few I/Os as their pageids allow
+        buffer_manager->read_ahead(image.children);
+        for (int child : image.children) {
+            auto child_datas = Node(buffer_manager,child).all_data();
             all_datas.merge(child_datas);
         }
-        return all_datas;
     }
+    return all_datas;
 }
 
-
 void Node::show() {
     if (is_leaf()) {
         std::cerr << "child" << std::endl;
@@ -3,13 +3,17 @@
 Page::Page():pageid(-1),
              dirty(false),
              pin_count(0),
-             access(0) {}
+             access(0),
+             writing(false),
+             prefetched(false) {}
 
 Page::Page(int pageid,const char page_[])
     :pageid(pageid),
      dirty(false),
      pin_count(0),
-     access(0) 
+     access(0),
+     writing(false),
+     prefetched(false)
 {
     std::copy(page_,page_+PAGESIZE,page);
 }
@@ -34,7 +38,6 @@ void Page::write(const char buf[],int offset,int len) {
 void Page::update_checksum(void) {
     unsigned int checksum = crc32(page + checksum_len,PAGESIZE - checksum_len);
     std::string checksum_str = to_hex(checksum);
-    dirty = true;
     std::copy(checksum_str.begin(),checksum_str.end(),page);
 }
 
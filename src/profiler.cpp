@@ -0,0 +1,106 @@
+#include "db.hpp"
+
+const char *phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::lock_wait:   return "lock_wait";
+        case Phase::execution:   return "execution";
+        case Phase::log_append:  return "log_append";
+        case Phase::log_flush:   return "log_flush";
+        case Phase::index_apply: return "index_apply";
+    }
+    assert(false);
+    return "";
+}
+
+Profiler::Profiler()
+    :enabled(false),
+     trace_empty(true),
+     origin(std::chrono::steady_clock::now()) {}
+
+Profiler::~Profiler() {
+    stop_trace();
+}
+
+std::chrono::steady_clock::time_point Profiler::now(void) {
+    if (!enabled) {
+        return std::chrono::steady_clock::time_point();
+    }
+    return std::chrono::steady_clock::now();
+}
+
+void Profiler::record(int txnid,Phase phase,std::chrono::steady_clock::time_point start,std::chrono::steady_clock::time_point end) {
+    if (!enabled) {
+        return;
+    }
+    double us = std::chrono::duration<double,std::micro>(end - start).count();
+    auto [it,_] = running.try_emplace(txnid);
+    (void)_;
+    it->second[static_cast<int>(phase)] += us;
+    if (trace.is_open()) {
+        // complete event. commit phases are inside the execution slice
+        // that ran the commit and nest under it in the viewer
+        trace << (trace_empty ? "\n" : ",\n") << std::fixed << std::setprecision(3)
+              << "{\"name\":\"" << phase_name(phase) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << txnid
+              << ",\"ts\":" << std::chrono::duration<double,std::micro>(start - origin).count()
+              << ",\"dur\":" << us << "}";
+        trace_empty = false;
+    }
+}
+
+// called once per run of a transaction, when it commits or aborts
+void Profiler::finish(int txnid) {
+    if (!enabled) {
+        return;
+    }
+    auto it = running.find(txnid);
+    if (it == running.end()) {
+        return;
+    }
+    auto &us = it->second;
+    // execution slices include the commit that ran inside them
+    int execution = static_cast<int>(Phase::execution);
+    for (int phase : {static_cast<int>(Phase::log_append),static_cast<int>(Phase::log_flush),static_cast<int>(Phase::index_apply)}) {
+        us[execution] -= us[phase];
+    }
+    us[execution] = std::max(us[execution],0.0);
+    for (int phase = 0;phase < PHASE_COUNT; phase++) {
+        phases[phase].add(us[phase]);
+    }
+    running.erase(it);
+}
+
+void Profiler::start_trace(const std::string &file_name) {
+    stop_trace();
+    trace.open(file_name,std::ios::trunc);
+    if (!trace) {
+        error("open(trace)");
+    }
+    trace << "{\"traceEvents\":[";
+    trace_empty = true;
+}
+
+void Profiler::stop_trace(void) {
+    if (trace.is_open()) {
+        trace << "\n]}" << std::endl;
+        trace.close();
+    }
+}
+
+void Profiler::report(std::ostream &out) {
+    out << std::left << std::setw(14) << "phase"
+        << std::setw(10) << "count"
+        << std::setw(12) << "mean(us)"
+        << std::setw(12) << "p50(us)"
+        << std::setw(12) << "p99(us)"
+        << "max(us)" << std::endl;
+    for (int phase = 0;phase < PHASE_COUNT; phase++) {
+        const LatencyHistogram &histogram = phases[phase];
+        out << std::left << std::setw(14) << phase_name(static_cast<Phase>(phase))
+            << std::setw(10) << histogram.count
+            << std::fixed << std::setprecision(1)
+            << std::setw(12) << histogram.mean()
+            << std::setw(12) << histogram.percentile(0.5)
+            << std::setw(12) << histogram.percentile(0.99)
+            << histogram.max_us << std::endl;
+    }
+}
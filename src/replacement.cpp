@@ -0,0 +1,180 @@
+#include "db.hpp"
+
+bool LruList::contains(int pageid) const {
+    return where.count(pageid) > 0;
+}
+
+int LruList::size(void) const {
+    return where.size();
+}
+
+void LruList::push_front(int pageid) {
+    assert(!contains(pageid));
+    order.push_front(pageid);
+    where[pageid] = order.begin();
+}
+
+void LruList::erase(int pageid) {
+    auto it = where.find(pageid);
+    assert(it != where.end());
+    order.erase(it->second);
+    where.erase(it);
+}
+
+int LruList::pop_back(void) {
+    assert(!order.empty());
+    int pageid = order.back();
+    erase(pageid);
+    return pageid;
+}
+
+void LruList::clear(void) {
+    order.clear();
+    where.clear();
+}
+
+int LruList::victim(BufferManager &buffer_manager) const {
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        if (buffer_manager.evictable(*it)) {
+            return *it;
+        }
+    }
+    return -1;
+}
+
+// Kin = 25%, Kout = 50% of the frames, as recommended in the 2Q paper
+TwoQueue::TwoQueue(int frames)
+    :kin(std::max(1,frames / 4)),
+     kout(std::max(1,frames / 2)) {}
+
+void TwoQueue::hit(int pageid) {
+    if (am.contains(pageid)) {
+        am.erase(pageid);
+        am.push_front(pageid);
+    }
+    // a hit in a1in is a correlated reference, it does not prove the page hot
+}
+
+// the page to evict. a1in gives up its oldest page while it is over kin,
+// that page is remembered in a1out
+int TwoQueue::victim(BufferManager &buffer_manager) {
+    int pageid = -1;
+    if (a1in.size() > kin || am.size() == 0) {
+        pageid = a1in.victim(buffer_manager);
+    }
+    if (pageid == -1) {
+        pageid = am.victim(buffer_manager);
+    }
+    if (pageid == -1) {
+        pageid = a1in.victim(buffer_manager);
+    }
+    if (pageid == -1) {
+        return -1;
+    }
+    if (a1in.contains(pageid)) {
+        a1in.erase(pageid);
+        a1out.push_front(pageid);
+        if (a1out.size() > kout) {
+            a1out.pop_back();
+        }
+    } else {
+        am.erase(pageid);
+    }
+    return pageid;
+}
+
+// a page coming back while its ghost is in a1out was evicted too early, it is hot
+void TwoQueue::admit(int pageid) {
+    if (a1out.contains(pageid)) {
+        a1out.erase(pageid);
+        am.push_front(pageid);
+    } else {
+        a1in.push_front(pageid);
+    }
+}
+
+void TwoQueue::clear(void) {
+    a1in.clear();
+    a1out.clear();
+    am.clear();
+}
+
+AdaptiveCache::AdaptiveCache(int frames)
+    :c(frames),
+     p(0) {}
+
+void AdaptiveCache::hit(int pageid) {
+    if (t1.contains(pageid)) {
+        t1.erase(pageid);
+    } else {
+        t2.erase(pageid);
+    }
+    t2.push_front(pageid);
+}
+
+// a ghost hit moves the target: a hit in b1 says t1 was too small, in b2 that t2 was
+void AdaptiveCache::miss(int pageid) {
+    if (b1.contains(pageid)) {
+        p = std::min((double)c,p + std::max(1.0,(double)b2.size() / b1.size()));
+    } else if (b2.contains(pageid)) {
+        p = std::max(0.0,p - std::max(1.0,(double)b1.size() / b2.size()));
+    }
+}
+
+// REPLACE of the paper, the evicted page becomes a ghost
+int AdaptiveCache::victim(int pageid,BufferManager &buffer_manager) {
+    int victim = -1;
+    bool from_t1 = t1.size() > 0 && (t1.size() > p || (b2.contains(pageid) && t1.size() == (int)p));
+    if (from_t1) {
+        victim = t1.victim(buffer_manager);
+    }
+    if (victim == -1) {
+        victim = t2.victim(buffer_manager);
+    }
+    if (victim == -1) {
+        victim = t1.victim(buffer_manager);
+    }
+    if (victim == -1) {
+        return -1;
+    }
+    if (t1.contains(victim)) {
+        t1.erase(victim);
+        b1.push_front(victim);
+    } else {
+        t2.erase(victim);
+        b2.push_front(victim);
+    }
+    return victim;
+}
+
+void AdaptiveCache::admit(int pageid) {
+    if (b1.contains(pageid)) {
+        b1.erase(pageid);
+        t2.push_front(pageid);
+        return;
+    }
+    if (b2.contains(pageid)) {
+        b2.erase(pageid);
+        t2.push_front(pageid);
+        return;
+    }
+    // keep |t1| + |b1| <= c and the whole directory <= 2c
+    if (t1.size() + b1.size() >= c) {
+        if (b1.size() > 0) {
+            b1.pop_back();
+        }
+    } else if (t1.size() + t2.size() + b1.size() + b2.size() >= 2 * c) {
+        if (b2.size() > 0) {
+            b2.pop_back();
+        }
+    }
+    t1.push_front(pageid);
+}
+
+void AdaptiveCache::clear(void) {
+    t1.clear();
+    t2.clear();
+    b1.clear();
+    b2.clear();
+    p = 0;
+}
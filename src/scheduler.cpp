@@ -1,9 +1,184 @@
 #include "db.hpp"
 
+FramePool::FramePool()
+    :free_frames(FRAME_POOL_MAX_FRAME / FRAME_POOL_ALIGN + 1),
+     allocations(0) {}
+
+FramePool::~FramePool() {
+    for (auto &frames : free_frames) {
+        for (void *frame : frames) {
+            free(frame);
+        }
+    }
+}
+
+// nullptr if malloc fails, the promise then returns an empty task
+void *FramePool::allocate(size_t size) {
+    size_t size_class = (size + FRAME_POOL_ALIGN - 1) / FRAME_POOL_ALIGN;
+    if (size_class < free_frames.size() && !free_frames[size_class].empty()) {
+        void *frame = free_frames[size_class].back();
+        free_frames[size_class].pop_back();
+        return frame;
+    }
+    ++allocations;
+    return malloc(std::max(size_class,size_t(1)) * FRAME_POOL_ALIGN);
+}
+
+void FramePool::deallocate(void *frame,size_t size) {
+    size_t size_class = (size + FRAME_POOL_ALIGN - 1) / FRAME_POOL_ALIGN;
+    if (size_class < free_frames.size()) {
+        free_frames[size_class].push_back(frame);
+    } else {
+        free(frame);
+    }
+}
+
+FramePool &frame_pool(void) {
+    static FramePool pool;
+    return pool;
+}
+
+Scheduler::Scheduler()
+    :max_retries(5),
+     backoff_base(1),
+     running(-1),
+     retry_count(0),
+     profiler(nullptr),
+     lock_manager(nullptr) {}
+
 void Scheduler::add_task(my_task &&task) {
     tasks.emplace_back(std::move(task));
     states.emplace_back(State::Execute);
-    // transactionsのemplace_backはtransaction.begin()のタイミングで行われる。
+    transactions.emplace_back(nullptr);
+    factories.emplace_back();
+    txnids.emplace_back(-1);
+    retries.emplace_back(0);
+    backoff.emplace_back(0);
+    wait_start.emplace_back();
+    // transactions[idx]はTransactionのコンストラクタで登録される。
+}
+
+void Scheduler::add_task(task_factory factory) {
+    add_task(factory());
+    factories.back() = std::move(factory);
+}
+
+// called from the Transaction constructor inside the task being resumed
+void Scheduler::register_transaction(Transaction *txn) {
+    if (running != -1) {
+        transactions[running] = txn;
+    }
+}
+
+// a retried task keeps the txnid of its first run
+int Scheduler::txnid(void) {
+    if (running != -1 && txnids[running] != -1) {
+        return txnids[running];
+    }
+    int txnid = fresh_txnid();
+    if (running != -1) {
+        txnids[running] = txnid;
+    }
+    return txnid;
+}
+
+void Scheduler::abort_task(int idx,int &finish_task_count) {
+    // a conditional write or a write in a read-only transaction fails again on retry,
+    // only conflicts are retried
+    bool retry = factories[idx] && retries[idx] < max_retries
+              && transactions[idx] != nullptr && !transactions[idx]->conditional_write_error
+              && !transactions[idx]->read_only_error;
+    if (profiler) {
+        profiler->finish(txnids[idx]);
+    }
+    tasks[idx].destroy_handle();
+    if (retry) {
+        backoff[idx] = backoff_base << retries[idx];
+        ++retries[idx];
+        ++retry_count;
+        states[idx] = State::Backoff;
+    } else {
+        finish_task(idx,finish_task_count);
+    }
+}
+
+// tasks[idx] committed or gave up. next_task may hand the slot a new transaction
+void Scheduler::finish_task(int idx,int &finish_task_count) {
+    if (task_finished) {
+        task_finished();
+    }
+    task_factory factory = next_task ? next_task() : task_factory();
+    if (!factory) {
+        states[idx] = State::Done;
+        ++finish_task_count;
+        return;
+    }
+    tasks[idx] = factory();
+    factories[idx] = std::move(factory);
+    transactions[idx] = nullptr;
+    txnids[idx] = -1;
+    retries[idx] = 0;
+    states[idx] = State::Execute;
+}
+
+int Scheduler::task_index(std::coroutine_handle<> handle) {
+    for (int idx = 0;idx < (int)tasks.size(); idx++) {
+        if (tasks[idx].owns(handle)) {
+            return idx;
+        }
+    }
+    assert(false);
+    return -1;
+}
+
+// bookkeeping after tasks[idx] ran from slice_start to its next suspension
+void Scheduler::stepped(int idx,std::chrono::steady_clock::time_point slice_start,std::vector<bool> &commit,int &finish_task_count) {
+    if (profiler) {
+        profiler->record(txnids[idx],Phase::execution,slice_start,profiler->now());
+    }
+    if (tasks[idx].waiting()) {
+        states[idx] = State::Wait;
+        if (profiler) {
+            wait_start[idx] = profiler->now();
+        }
+    }
+    if (tasks[idx].abort()) {
+        abort_task(idx,finish_task_count);
+    } else if (tasks[idx].commit()) {
+        commit[idx] = true;
+        if (profiler) {
+            profiler->finish(txnids[idx]);
+        }
+        tasks[idx].destroy_handle();
+        finish_task(idx,finish_task_count);
+    }
+}
+
+// the lock manager decided the requests of waiting tasks whose holders finished.
+// a granted coroutine is resumed through its handle right away, an aborted one
+// is dropped
+void Scheduler::resume_granted(std::vector<bool> &commit,int &finish_task_count) {
+    lock_manager->grant_woken();
+    while (!lock_manager->runnable.empty()) {
+        auto [handle,try_lock_result] = lock_manager->runnable.front();
+        lock_manager->runnable.pop_front();
+        int idx = task_index(handle);
+        assert(states[idx] == State::Wait);
+        running = idx;
+        if (profiler) {
+            profiler->record(txnids[idx],Phase::lock_wait,wait_start[idx],profiler->now());
+        }
+        if (try_lock_result == TryLockResult::Abort) {
+            abort_task(idx,finish_task_count);
+            continue;
+        }
+        states[idx] = State::Execute;
+        auto slice_start = profiler ? profiler->now() : std::chrono::steady_clock::time_point();
+        handle.resume();
+        stepped(idx,slice_start,commit,finish_task_count);
+        // the step may have finished holders in turn
+        lock_manager->grant_woken();
+    }
 }
 
 std::vector<bool> Scheduler::start(void) {
@@ -12,85 +187,55 @@ std::vector<bool> Scheduler::start(void) {
         return {};
     }
 
+    std::vector<bool> commit(tasks_size,false);
     int finish_task_count = 0;
     int idx = 0;
     while (finish_task_count < tasks_size) {
+        running = idx;
         switch (states[idx]) {
             case State::Execute :
                 if (tasks[idx].can_move()) {
+                    auto slice_start = profiler ? profiler->now() : std::chrono::steady_clock::time_point();
                     tasks[idx].move_next();
-                    if (tasks[idx].waiting()) {
-                        states[idx] = State::Wait;
-                    }
-                    if (tasks[idx].abort()) {
-                        tasks[idx].destroy_handle();
-                        states[idx] = State::Done;
-                        ++finish_task_count;
-                    }
-                    if (tasks[idx].commit()) {
-                        tasks[idx].destroy_handle();
-                        states[idx] = State::Done;
-                        ++finish_task_count;
-                    }
+                    stepped(idx,slice_start,commit,finish_task_count);
                 } else {
+                    if (profiler) {
+                        profiler->finish(txnids[idx]);
+                    }
                     transactions[idx]->unlock();
-                    states[idx] = State::Done;
-                    ++finish_task_count;
+                    finish_task(idx,finish_task_count);
                 }
                 break;
             case State::Wait :
-                // try waiting lock
-                // exec waiting data operation
-                {
-                    TryLockResult try_lock_result;
-                    auto [data_ope,key,value] = tasks[idx].data_operation();
-                    switch (data_ope) {
-                        case OpeKind::select:
-                            try_lock_result = transactions[idx]->select_internal(key);
-                            break;
-                        case OpeKind::insert:
-                            try_lock_result = transactions[idx]->insert_internal(key,value);
-                            break;
-                        case OpeKind::update:
-                            try_lock_result = transactions[idx]->update_internal(key,value);
-                            break;
-                        case OpeKind::del:
-                            try_lock_result = transactions[idx]->del_internal(key);
-                            break;
-                        default:
-                            assert(false);
-                    }
-                    switch (try_lock_result) {
-                        case TryLockResult::GetLock:
-                            states[idx] = State::Execute;
-                            break;
-                        case TryLockResult::Abort:
-                            tasks[idx].destroy_handle();
-                            states[idx] = State::Done;
-                            ++finish_task_count;
-                            break;
-                        case TryLockResult::Wait:
-                            break;
-                        default:
-                            assert(false);
-                    }
-                    break;
+                // resumed by resume_granted, never polled
+                break;
+            case State::Backoff :
+                if (--backoff[idx] <= 0) {
+                    tasks[idx] = factories[idx]();
+                    transactions[idx] = nullptr;
+                    states[idx] = State::Execute;
                 }
+                break;
             case State::Done :
                 break;
         }
+        if (lock_manager) {
+            resume_granted(commit,finish_task_count);
+        }
         ++idx;
         if (idx == tasks_size) idx = 0;
     }
+    running = -1;
+    assert(!lock_manager || (lock_manager->blocked.empty() && lock_manager->runnable.empty()));
 
-    std::vector<bool> commit(tasks_size,false);
-    for (int i = 0;i < tasks_size; i++) {
-        commit[i] = tasks[i].commit();
-    }
     tasks.clear();
     states.clear();
     transactions.clear();
+    factories.clear();
+    txnids.clear();
+    retries.clear();
+    backoff.clear();
+    wait_start.clear();
 
     return commit;
 }
-
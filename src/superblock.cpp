@@ -0,0 +1,108 @@
+#include "db.hpp"
+
+// superblock (page 0 of the btree file)
+// checksum magic version page_size root_pageid free_list_head checkpoint_lsn
+// | 8     | | 8 | | 8   | | 8     | | 8       | | 8          | | 16         |
+// free_list_head = ffffffff if there is no free page
+
+const int superblock_pageid = 0;
+
+const char superblock_magic[] = "mydbtree";
+const int format_version = 1;
+
+const int magic_len          = 8;
+const int version_len        = 8;
+const int page_size_len      = 8;
+const int root_pageid_len    = 8;
+const int free_list_head_len = 8;
+const int checkpoint_lsn_len = 16;
+
+const int magic_offset          = checksum_len;
+const int version_offset        = magic_offset + magic_len;
+const int page_size_offset      = version_offset + version_len;
+const int root_pageid_offset    = page_size_offset + page_size_len;
+const int free_list_head_offset = root_pageid_offset + root_pageid_len;
+const int checkpoint_lsn_offset = free_list_head_offset + free_list_head_len;
+
+Superblock::Superblock(BufferManager *buffer_manager)
+    :buffer_manager(buffer_manager) {}
+
+void Superblock::format(void) {
+    buffer_manager->write_page(superblock_pageid,superblock_magic,magic_offset,magic_len);
+    std::string version_str = to_hex(format_version);
+    buffer_manager->write_page(superblock_pageid,version_str.c_str(),version_offset,version_len);
+    std::string page_size_str = to_hex(PAGESIZE);
+    buffer_manager->write_page(superblock_pageid,page_size_str.c_str(),page_size_offset,page_size_len);
+    set_root_pageid(-1);
+    set_free_list_head(-1);
+    set_checkpoint_lsn(0);
+}
+
+// O(1) check that the file was written by this format and flushed completely
+bool Superblock::validate(void) {
+    if (buffer_manager->disk_manager.page_num == 0) {
+        return false;
+    }
+    if (!buffer_manager->confirm_checksum(superblock_pageid)) {
+        return false;
+    }
+    const char *buf = buffer_manager->read_page(superblock_pageid,magic_offset,magic_len);
+    bool magic_ok = strncmp(buf,superblock_magic,magic_len) == 0;
+    free(const_cast<char*>(buf));
+    if (!magic_ok || version() != format_version || page_size() != PAGESIZE) {
+        return false;
+    }
+    int root = root_pageid();
+    int page_num = buffer_manager->disk_manager.page_num;
+    return 0 < root && root < page_num && free_list_head() < page_num;
+}
+
+int Superblock::version(void) {
+    const char *buf = buffer_manager->read_page(superblock_pageid,version_offset,version_len);
+    int version = strtol(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return version;
+}
+
+int Superblock::page_size(void) {
+    const char *buf = buffer_manager->read_page(superblock_pageid,page_size_offset,page_size_len);
+    int page_size = strtol(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return page_size;
+}
+
+int Superblock::root_pageid(void) {
+    const char *buf = buffer_manager->read_page(superblock_pageid,root_pageid_offset,root_pageid_len);
+    int root_pageid = strtoul(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return root_pageid;
+}
+
+int Superblock::free_list_head(void) {
+    const char *buf = buffer_manager->read_page(superblock_pageid,free_list_head_offset,free_list_head_len);
+    int free_list_head = strtoul(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return free_list_head;
+}
+
+unsigned long long Superblock::checkpoint_lsn(void) {
+    const char *buf = buffer_manager->read_page(superblock_pageid,checkpoint_lsn_offset,checkpoint_lsn_len);
+    unsigned long long checkpoint_lsn = strtoull(buf,NULL,16);
+    free(const_cast<char*>(buf));
+    return checkpoint_lsn;
+}
+
+void Superblock::set_root_pageid(int root_pageid) {
+    std::string root_pageid_str = to_hex(root_pageid);
+    buffer_manager->write_page(superblock_pageid,root_pageid_str.c_str(),root_pageid_offset,root_pageid_len);
+}
+
+void Superblock::set_free_list_head(int free_list_head) {
+    std::string free_list_head_str = to_hex(free_list_head);
+    buffer_manager->write_page(superblock_pageid,free_list_head_str.c_str(),free_list_head_offset,free_list_head_len);
+}
+
+void Superblock::set_checkpoint_lsn(unsigned long long checkpoint_lsn) {
+    std::string checkpoint_lsn_str = to_hex(checkpoint_lsn >> 32) + to_hex(checkpoint_lsn & 0xffffffffu);
+    buffer_manager->write_page(superblock_pageid,checkpoint_lsn_str.c_str(),checkpoint_lsn_offset,checkpoint_lsn_len);
+}
@@ -28,18 +28,33 @@ std::optional<std::tuple<char,std::string,std::string>> log2data(size_t &idx,con
     return make_tuple(mode,key,value);
 }
 
-Table::Table(const std::string &btree_file_name,const std::string &data_file_name,const std::string &log_file_name)
-    :btree(btree_file_name),
+Table::Table(const std::string &btree_file_name,const std::string &data_file_name,const std::string &log_file_name,
+             ConcurrencyControl concurrency_control,
+             DeadlockPolicy deadlock_policy,
+             ReplacementPolicy replacement_policy)
+    :btree(btree_file_name,replacement_policy),
+     concurrency_control(concurrency_control),
      data_file_name(data_file_name),
      log_manager(LogManager(log_file_name)),
-     lock_manager(LockManager()) 
+     lock_manager(LockManager(deadlock_policy)),
+     stats_dump_file_name(""),
+     stats_dump_interval(0)
 {
+    scheduler.profiler = &profiler;
+    scheduler.lock_manager = &lock_manager;
+    // the dump interval is checked while the scheduler runs, a closed loop
+    // may keep one exec_transaction busy for a whole benchmark
+    scheduler.task_finished = [this] { dump_stats_if_due(); };
+
     std::ofstream data_file;
     data_file.open(data_file_name,std::ios::app);
     if (!data_file) {
         error("open(data_file)");
     }
     data_file.close();
+
+    // the log holds everything written after the last checkpoint
+    log_manager.lsn = btree.superblock.checkpoint_lsn() + file_size(log_file_name);
 }
 
 // flush  btree
@@ -48,6 +63,7 @@ Table::Table(const std::string &btree_file_name,const std::string &data_file_nam
 void Table::checkpointing() {
 
     // btree flush
+    btree.set_checkpoint_lsn(log_manager.lsn);
     btree.flush();
 
     // write tmp_data_file
@@ -62,7 +78,7 @@ void Table::checkpointing() {
     }
     data_file_tmp.close();
 
-    file_sync(data_file_tmp_name);
+    file_sync(data_file_tmp_name,data_io);
 
     // rename
     if (rename(data_file_tmp_name.c_str(),data_file_name.c_str()) == -1) {
@@ -70,7 +86,7 @@ void Table::checkpointing() {
     }
 
     // fsync
-    file_sync(data_file_name);
+    file_sync(data_file_name,data_io);
 
     // erase log
     log_manager.erase_log();
@@ -79,10 +95,11 @@ void Table::checkpointing() {
 // 電源をonしたときにwalにlogが残っていればそのlogとdatabase dump fileから
 // database本体のファイルとbtreeを復元
 // walのlogを消してcheckpointingする。
+// btreeのsuperblockが壊れているときも同様に復元する。
 // そうでないときそのままbtreeをを使う。
 void Table::recovery() {
 
-    if (file_size(log_manager.log_file_name) == 0) {
+    if (file_size(log_manager.log_file_name) == 0 && btree.valid) {
         return;
     }
 
@@ -126,22 +143,18 @@ void Table::recovery() {
             write_set[key] = make_pair(OpeKind::update,value);
         } else if(mode == 'd') {
             write_set[key] = make_pair(OpeKind::del,value);
+        } else if (mode == 'a') {
+            write_set.clear();
         } else {
             assert(mode == 'c');
             for (auto [key,mode_value] : write_set) {
                 OpeKind mode = mode_value.first;
                 std::string value = mode_value.second;
                 if (mode == OpeKind::update || mode == OpeKind::insert) {
-                    if (btree.search(key) == std::nullopt) {
-                        btree.insert(key,value);
-                    } else {
-                        btree.update(key,value);
-                    }
+                    btree.upsert(key,value);
                 } else {
                     assert(mode == OpeKind::del);
-                    if (btree.search(key) != std::nullopt) {
-                        btree.del(key);
-                    }
+                    btree.erase(key);
                 }
             }
             write_set.clear();
@@ -150,12 +163,105 @@ void Table::recovery() {
     log_file_input.close();
 
     checkpointing();
+    btree.valid = true;
 }
 
 void Table::add_transaction(my_task&& task) {
     scheduler.add_task(std::move(task));
 }
 
+// the transaction is rebuilt from factory and retried when it aborts
+void Table::add_transaction(task_factory factory) {
+    scheduler.add_task(std::move(factory));
+}
+
 std::vector<bool> Table::exec_transaction(void) {
     return scheduler.start();
+}
+
+TableStats Table::stats(void) {
+    BufferManager &buffer_manager = btree.buffer_manager;
+    int pinned_frames = buffer_manager.pinned_frames();
+    // the background writer updates the buffer and btree I/O counters
+    auto guard = buffer_manager.latch_guard();
+    return TableStats{buffer_manager.stats,
+                      (int)buffer_manager.pagetable.size(),
+                      pinned_frames,
+                      (int)buffer_manager.pages.size(),
+                      lock_manager.stats,
+                      buffer_manager.disk_manager.io_stats,
+                      log_manager.io_stats,
+                      data_io};
+}
+
+void dump_io_stats(std::ostream &out,const IOStats &io_stats) {
+    out << "{\"reads\":" << io_stats.reads
+        << ",\"writes\":" << io_stats.writes
+        << ",\"syncs\":" << io_stats.syncs
+        << ",\"bytes_read\":" << io_stats.bytes_read
+        << ",\"bytes_written\":" << io_stats.bytes_written
+        << ",\"read_p99_us\":" << io_stats.read_latency.percentile(0.99)
+        << ",\"write_p99_us\":" << io_stats.write_latency.percentile(0.99)
+        << ",\"sync_p50_us\":" << io_stats.sync_latency.percentile(0.5)
+        << ",\"sync_p99_us\":" << io_stats.sync_latency.percentile(0.99)
+        << ",\"sync_max_us\":" << io_stats.sync_latency.max_us
+        << "}";
+}
+
+// one JSON object per line
+void Table::dump_stats(const std::string &file_name) {
+    std::ofstream file(file_name,std::ios::app);
+    if (!file) {
+        error("open(stats_dump_file)");
+    }
+    TableStats s = stats();
+    unsigned long long accesses = s.buffer.hits + s.buffer.misses;
+    auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    file << std::fixed << std::setprecision(4)
+         << "{\"time_ms\":" << time
+         << ",\"buffer\":{\"hits\":" << s.buffer.hits
+         << ",\"misses\":" << s.buffer.misses
+         << ",\"hit_ratio\":" << (accesses == 0 ? 0.0 : (double)s.buffer.hits / accesses)
+         << ",\"evictions\":" << s.buffer.evictions
+         << ",\"dirty_writebacks\":" << s.buffer.dirty_writebacks
+         << ",\"sweep_steps\":" << s.buffer.sweep_steps
+         << ",\"max_sweep\":" << s.buffer.max_sweep
+         << ",\"readahead_ios\":" << s.buffer.readahead_ios
+         << ",\"readahead_pages\":" << s.buffer.readahead_pages
+         << ",\"readahead_hits\":" << s.buffer.readahead_hits
+         << ",\"resident_pages\":" << s.resident_pages
+         << ",\"pinned_frames\":" << s.pinned_frames
+         << ",\"buffer_size\":" << s.buffer_size
+         << "},\"lock\":{\"acquisitions\":" << s.lock.acquisitions
+         << ",\"waits\":" << s.lock.waits
+         << ",\"aborts\":" << s.lock.aborts
+         << ",\"wounds\":" << s.lock.wounds
+         << ",\"deadlocks\":" << s.lock.deadlocks
+         << ",\"escalations\":" << s.lock.escalations
+         << "},\"btree_io\":";
+    dump_io_stats(file,s.btree_io);
+    file << ",\"log_io\":";
+    dump_io_stats(file,s.log_io);
+    file << ",\"data_io\":";
+    dump_io_stats(file,s.data_io);
+    file << "}" << std::endl;
+}
+
+void Table::dump_stats_if_due(void) {
+    if (stats_dump_file_name == "") {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_stats_dump >= stats_dump_interval) {
+        dump_stats(stats_dump_file_name);
+        last_stats_dump = now;
+    }
+}
+
+// interval 0 dumps after every finished transaction
+void Table::set_stats_dump(const std::string &file_name,std::chrono::milliseconds interval) {
+    stats_dump_file_name = file_name;
+    stats_dump_interval = interval;
+    last_stats_dump = std::chrono::steady_clock::time_point();
 }
\ No newline at end of file
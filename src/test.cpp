@@ -364,10 +364,88 @@ void btree_ondisk_test(void) {
         auto index = btree2.all_data();
         assert(index.size() == 0);
     }
+    {
+        // upsert and erase report the old value
+        BTree btree(file_name);
+        std::map<std::string,std::string> mp2;
+        std::mt19937_64 rnd(0);
+        std::uniform_int_distribution<int> dist(0,999);
+        for(int i = 0;i < 20000; i++) {
+            std::string key = "key" + std::to_string(dist(rnd));
+            std::optional<std::string> right_value;
+            if (mp2.count(key) > 0) {
+                right_value = mp2[key];
+            }
+            if (i % 3 == 0) {
+                assert(btree.erase(key) == right_value);
+                mp2.erase(key);
+            } else {
+                assert(btree.upsert(key,std::to_string(i)) == right_value);
+                mp2[key] = std::to_string(i);
+            }
+        }
+        assert(btree.all_data() == mp2);
+        btree.clear();
+    }
     remove(file_name.c_str());
     std::cerr << "btree_ondisk_test success!" << std::endl;
 } 
 
+void superblock_test(void) {
+    std::string file_name = "superblock_test.txt";
+    int root_pageid;
+    int free_list_head;
+    {
+        BTree btree(file_name);
+        assert(btree.valid);
+        assert(btree.superblock.version() == 1);
+        assert(btree.superblock.page_size() == PAGESIZE);
+        assert(btree.superblock.root_pageid() == 1);
+        for(int i = 0;i < 1000; i++) {
+            btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        // root split moves the root instead of copying it
+        assert(btree.root->pageid != 1);
+        assert(btree.superblock.root_pageid() == btree.root->pageid);
+        for(int i = 0;i < 1000; i++) {
+            if (i % 10 != 0) {
+                assert(btree.del("key" + std::to_string(i)));
+            }
+        }
+        assert(btree.buffer_manager.free_list_head != -1);
+        btree.set_checkpoint_lsn(12345);
+        root_pageid = btree.root->pageid;
+        free_list_head = btree.buffer_manager.free_list_head;
+    }
+    {
+        BTree btree(file_name);
+        assert(btree.valid);
+        assert(btree.root->pageid == root_pageid);
+        assert(btree.buffer_manager.free_list_head == free_list_head);
+        assert(btree.superblock.checkpoint_lsn() == 12345);
+        assert(btree.all_data().size() == 100);
+
+        // freed pages are reused before the file grows
+        int page_num = btree.buffer_manager.disk_manager.page_num;
+        for(int i = 0;btree.buffer_manager.free_list_head != -1; i++) {
+            btree.insert("new_key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        assert(btree.buffer_manager.disk_manager.page_num == page_num);
+    }
+    {
+        // broken superblock
+        std::fstream file(file_name);
+        file.seekp(checksum_len);
+        file.write("broken!!",8);
+        file.close();
+        BTree btree(file_name);
+        assert(!btree.valid);
+        assert(btree.all_data().size() == 0);
+    }
+    remove(file_name.c_str());
+    std::cerr << "superblock_test success!" << std::endl;
+}
+
 void lock_manager_test(void) {
     {
         Lock lock = Lock_exclusive(1);
@@ -412,6 +490,21 @@ void lock_manager_test(void) {
         assert(lock_manager.try_shared_lock("key",1) == TryLockResult::GetLock);
         assert(lock_manager.try_exclusive_lock("key",2) == TryLockResult::Abort);
     }
+    {
+        LockManager lock_manager = LockManager();
+        for(int i = 0;i < 1000; i++) {
+            assert(lock_manager.try_exclusive_lock("key" + std::to_string(i),1) == TryLockResult::GetLock);
+            assert(lock_manager.try_shared_lock("key" + std::to_string(i),0) == TryLockResult::Wait);
+        }
+        assert(lock_manager.size() == 1000);
+        for(auto &partition : lock_manager.partitions) {
+            assert(partition.lock_table.size() > 0);
+        }
+        for(int i = 0;i < 1000; i++) {
+            lock_manager.unlock("key" + std::to_string(i),1);
+        }
+        assert(lock_manager.size() == 0);
+    }
     std::cerr << "lock_manager_test success!" << std::endl;
 }
 
@@ -606,10 +699,26 @@ void transaction_test() {
         txn.begin();
         txn.del("key4");
         assert(!txn.commit());
+        // the writes applied before the failed one are undone
+        txn.begin();
+        txn.insert("key5","value5");
+        txn.update("key2","value2_new");
+        txn.insert("key6","value6");
+        txn.insert("key1","value1_new");
+        assert(!txn.commit());
         auto index = table.btree.all_data();
         assert(index.size() == 2);
         assert(index["key1"] == "value1");
         assert(index["key2"] == "value2");
+        // recovery skips the records of the failed commits
+        txn.begin();
+        txn.insert("key9","value9");
+        assert(txn.commit());
+        table.btree.clear();
+        table.recovery();
+        index = table.btree.all_data();
+        assert(index.size() == 1);
+        assert(index["key9"] == "value9");
         remove(btree_file_name.c_str());
         remove(data_file_name.c_str());
         remove(log_file_name.c_str());
@@ -634,6 +743,57 @@ void transaction_test() {
         remove(data_file_name.c_str());
         remove(log_file_name.c_str());
     }
+    {
+        Arena arena;
+        std::vector<std::string_view> views;
+        for (int i = 0;i < 10000; i++) {
+            views.push_back(arena.store("key" + std::to_string(i)));
+        }
+        for (int i = 0;i < 10000; i++) {
+            assert(views[i] == "key" + std::to_string(i));
+        }
+        arena.release();
+        // released memory is handed out again from the start
+        assert(arena.store("key").data() == arena.initial);
+    }
+    {
+        // a key read then written is stored once and kept across the move
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        Transaction txn(&table);
+        txn.begin();
+        txn.select("key1");
+        const char *stored = txn.read_set.begin()->first.data();
+        txn.update("key1","value1_new");
+        assert(txn.read_set.size() == 0);
+        assert(txn.write_set.begin()->first.data() == stored);
+        assert(txn.get_value("key1") == "value1_new");
+        assert(txn.commit());
+        assert(txn.write_set.size() == 0 && txn.read_set.size() == 0);
+        assert(table.btree.search("key1") == "value1_new");
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        // a transaction that wrote nothing leaves no trace in the log
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        Transaction txn(&table);
+        txn.begin();
+        txn.select("key1");
+        txn.select("key2");
+        assert(txn.commit());
+        assert(table.lock_manager.size() == 0);
+        txn.begin(true);
+        txn.select("key1");
+        assert(txn.commit());
+        assert(table.log_manager.lsn == 0);
+        assert(file_size(log_file_name) == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
     std::cerr << "transaction_test success!" << std::endl;
 }
 
@@ -772,6 +932,14 @@ void concurrent_test(void) {
         }
         table.exec_transaction();
 
+        // the second round reuses the frames of the first
+        unsigned long long allocations = frame_pool().allocations;
+        for (int i = 0;i < 100; i++) {
+            table.add_transaction(transaction6(&table));
+        }
+        table.exec_transaction();
+        assert(frame_pool().allocations == allocations);
+
         remove(btree_file_name.c_str());
         remove(data_file_name.c_str());
         remove(log_file_name.c_str());
@@ -779,6 +947,1230 @@ void concurrent_test(void) {
     std::cerr << "concurrent_test success!" << std::endl;
 }
 
+my_task snapshot_reader(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin(true);
+    auto v1 = co_await txn.select("key1");
+    assert(v1.value() == "value1");
+    co_await txn.select("key3");
+    co_await txn.select("key3");
+    // written and committed by snapshot_writer after the snapshot was taken
+    auto v2 = co_await txn.select("key2");
+    assert(v2.value() == "value2");
+    co_yield txn.commit();
+    co_return;
+}
+
+my_task snapshot_writer(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.update("key1","value1_new"); // no wait, the reader holds no lock
+    co_await txn.update("key2","value2_new");
+    co_yield txn.commit();
+    co_return;
+}
+
+void snapshot_test(void) {
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        Transaction reader(&table);
+        reader.begin(true);
+        Transaction writer(&table);
+        writer.begin();
+        writer.update("key1","value1_new");
+        writer.insert("key2","value2");
+        assert(writer.commit());
+        reader.select("key1");assert(reader.get_value("key1") == "value1");
+        reader.select("key2");assert(reader.get_value("key2") == std::nullopt);
+        assert(table.lock_manager.size() == 0);
+        assert(reader.commit());
+        assert(table.version_store.undo.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        // a write in a read-only transaction aborts it
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        Transaction reader(&table);
+        reader.begin(true);
+        assert(std::get<1>(reader.update("key1","value1_new")) == TryLockResult::Abort);
+        assert(reader.read_only_error);
+        assert(!table.version_store.has_snapshot());
+        reader.begin(true);
+        assert(std::get<1>(reader.lock_table(true)) == TryLockResult::Abort);
+        assert(table.btree.search("key1") == "value1");
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        // versions are collected when the oldest snapshot ends
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        Transaction reader1(&table),reader2(&table),writer(&table);
+        reader1.begin(true);
+        writer.begin();
+        writer.update("key1","value2");
+        assert(writer.commit());
+        reader2.begin(true);
+        writer.begin();
+        writer.update("key1","value3");
+        assert(writer.commit());
+        assert(table.version_store.undo["key1"].size() == 2);
+        reader1.select("key1");assert(reader1.get_value("key1") == "value1");
+        assert(reader1.commit());
+        assert(table.version_store.undo["key1"].size() == 1);
+        reader2.select("key1");assert(reader2.get_value("key1") == "value2");
+        assert(reader2.commit());
+        assert(table.version_store.undo.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        table.add_transaction(snapshot_reader(&table));
+        table.add_transaction(snapshot_writer(&table));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        auto index = table.btree.all_data();
+        assert(index["key1"] == "value1_new");
+        assert(index["key2"] == "value2_new");
+        assert(table.version_store.undo.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "snapshot_test success!" << std::endl;
+}
+
+void occ_test(void) {
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name,ConcurrencyControl::OCC);
+        table.btree.insert("key1","value1");
+        Transaction txn1(&table);
+        Transaction txn2(&table);
+        txn1.begin();
+        txn2.begin();
+        assert(get<1>(txn1.select("key1")) == TryLockResult::GetLock);
+        assert(get<1>(txn2.update("key1","value1_new")) == TryLockResult::GetLock);
+        assert(table.lock_manager.size() == 0);
+        assert(txn2.commit());
+        // key1 was overwritten after txn1 read it
+        txn1.insert("key2","value2");
+        assert(!txn1.commit());
+        auto index = table.btree.all_data();
+        assert(index.size() == 1);
+        assert(index["key1"] == "value1_new");
+        assert(table.version_store.write_ts.size() == 0);
+
+        txn1.begin();
+        txn2.begin();
+        txn1.select("key1");
+        txn2.select("key1");
+        txn1.insert("key2","value2");
+        txn2.insert("key3","value3");
+        assert(txn1.commit());
+        assert(txn2.commit());
+        index = table.btree.all_data();
+        assert(index.size() == 3);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name,ConcurrencyControl::OCC);
+        table.add_transaction(transaction1(&table));
+        table.add_transaction(transaction2(&table));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        auto index = table.btree.all_data();
+        assert(index["key1"] == "value1");
+        assert(index["key2"] == "value1");
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "occ_test success!" << std::endl;
+}
+
+void deadlock_policy_test(void) {
+    {
+        LockManager lock_manager(DeadlockPolicy::WoundWait);
+        assert(lock_manager.try_exclusive_lock("key",3) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key",5) == TryLockResult::Wait);
+        assert(lock_manager.wounded.size() == 0);
+        // older requester wounds the holder and waits
+        assert(lock_manager.try_exclusive_lock("key",1) == TryLockResult::Wait);
+        assert(lock_manager.wounded.count(3) > 0);
+        assert(lock_manager.try_shared_lock("key2",3) == TryLockResult::Abort);
+        lock_manager.unlock("key",3);
+        lock_manager.finish(3);
+        assert(lock_manager.try_exclusive_lock("key",1) == TryLockResult::GetLock);
+        assert(lock_manager.stats.wounds == 1);
+        assert(lock_manager.stats.aborts == 1);
+        assert(lock_manager.stats.waits == 2);
+    }
+    {
+        LockManager lock_manager(DeadlockPolicy::Detection);
+        assert(lock_manager.try_exclusive_lock("key1",1) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key2",2) == TryLockResult::GetLock);
+        assert(lock_manager.try_shared_lock("key3",3) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key2",1) == TryLockResult::Wait);
+        assert(lock_manager.try_exclusive_lock("key3",2) == TryLockResult::Wait);
+        // 3 -> 1 -> 2 -> 3
+        assert(lock_manager.try_exclusive_lock("key1",3) == TryLockResult::Abort);
+        assert(lock_manager.stats.deadlocks == 1);
+        // no cycle, the younger one may wait as well
+        assert(lock_manager.try_exclusive_lock("key1",4) == TryLockResult::Wait);
+    }
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    for (auto policy : {DeadlockPolicy::WaitDie,DeadlockPolicy::WoundWait,DeadlockPolicy::Detection}) {
+        Table table(btree_file_name,data_file_name,log_file_name,ConcurrencyControl::S2PL,policy);
+        for (int i = 0;i < 100; i++) {
+            table.add_transaction(transaction6(&table));
+        }
+        auto commit = table.exec_transaction();
+        assert(std::count(commit.begin(),commit.end(),true) > 0);
+        assert(table.lock_manager.size() == 0);
+        assert(table.lock_manager.wounded.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "deadlock_policy_test success!" << std::endl;
+}
+
+my_task retry_transaction(Table *table,std::string key1,std::string key2,std::vector<int> *txnids) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    txnids->push_back(txn.txnid);
+    co_await txn.update(key1,key1 + "_new");
+    co_await txn.update(key2,key2 + "_new");
+    co_yield txn.commit();
+    co_return;
+}
+
+void retry_test(void) {
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        std::vector<int> txnids1,txnids2;
+
+        // without a factory the younger transaction dies (wait-die)
+        table.add_transaction(retry_transaction(&table,"key1","key2",&txnids1));
+        table.add_transaction(retry_transaction(&table,"key2","key1",&txnids2));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && !commit[1]);
+
+        // with a factory it is retried with its first txnid
+        txnids1.clear();
+        txnids2.clear();
+        table.add_transaction([&]{ return retry_transaction(&table,"key1","key2",&txnids1); });
+        table.add_transaction([&]{ return retry_transaction(&table,"key2","key1",&txnids2); });
+        commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        assert(txnids1.size() == 1);
+        assert(txnids2.size() == 2);
+        assert(txnids2[0] == txnids2[1]);
+        assert(table.scheduler.retry_count == 1);
+        assert(table.lock_manager.size() == 0);
+        auto index = table.btree.all_data();
+        assert(index["key1"] == "key1_new");
+        assert(index["key2"] == "key2_new");
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.scheduler.max_retries = 0;
+        std::vector<int> txnids1,txnids2;
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        table.add_transaction([&]{ return retry_transaction(&table,"key1","key2",&txnids1); });
+        table.add_transaction([&]{ return retry_transaction(&table,"key2","key1",&txnids2); });
+        auto commit = table.exec_transaction();
+        assert(commit[0] && !commit[1]);
+        assert(table.scheduler.retry_count == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        // closed loop: two slots run six transactions, a finished one is replaced at once
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        std::vector<int> txnids;
+        int started = 0;
+        auto next_task = [&]() -> task_factory {
+            if (started == 6) {
+                return task_factory();
+            }
+            bool forward = started++ % 2 == 0;
+            return [&table,&txnids,forward]{
+                return forward ? retry_transaction(&table,"key1","key2",&txnids)
+                               : retry_transaction(&table,"key2","key1",&txnids);
+            };
+        };
+        table.add_transaction(next_task());
+        table.add_transaction(next_task());
+        table.scheduler.next_task = next_task;
+        auto commit = table.exec_transaction();
+        table.scheduler.next_task = nullptr;
+        assert(commit.size() == 2);
+        assert(started == 6);
+        assert(std::set<int>(txnids.begin(),txnids.end()).size() == 6);
+        assert(txnids.size() == 6 + table.scheduler.retry_count);
+        assert(table.lock_manager.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "retry_test success!" << std::endl;
+}
+
+my_task scan_inserter(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.select("key0");
+    co_await txn.insert("key3","value3");
+    co_yield txn.commit();
+    co_return;
+}
+
+my_task scan_scanner(Table *table,std::vector<std::map<std::string,std::string>> *results) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.scan("key1","key5");
+    results->push_back(txn.scan_result);
+    co_await txn.select("key9");
+    co_await txn.scan("key1","key5");
+    results->push_back(txn.scan_result);
+    co_yield txn.commit();
+    co_return;
+}
+
+void scan_test(void) {
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        LockManager lock_manager;
+        assert(lock_manager.try_exclusive_lock("key2",1) == TryLockResult::GetLock);
+        // older scanner waits for the writer inside the range, younger one dies
+        assert(lock_manager.try_range_lock("key1","key3",0) == TryLockResult::Wait);
+        assert(lock_manager.try_range_lock("key1","key3",2) == TryLockResult::Abort);
+        assert(lock_manager.try_range_lock("key3","key5",2) == TryLockResult::GetLock);
+        assert(lock_manager.try_range_lock("key3","key4",2) == TryLockResult::GetLock);
+        assert(lock_manager.range_locks.size() == 1);
+        // a key that does not exist yet is still covered
+        assert(lock_manager.try_exclusive_lock("key4",3) == TryLockResult::Abort);
+        assert(lock_manager.try_exclusive_lock("key4",1) == TryLockResult::Wait);
+        assert(lock_manager.try_exclusive_lock("key5",1) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key4",2) == TryLockResult::GetLock);
+        lock_manager.unlock("key4",2);
+        lock_manager.finish(2);
+        assert(lock_manager.range_locks.size() == 0);
+        assert(lock_manager.try_exclusive_lock("key4",1) == TryLockResult::GetLock);
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        std::map<std::string,std::string> datas;
+        for (int i = 0;i < 200; i++) {
+            std::string key = "key" + std::to_string(1000 + i);
+            table.btree.insert(key,"value" + std::to_string(i));
+            datas[key] = "value" + std::to_string(i);
+        }
+        auto range = table.btree.range("key1050","key1150");
+        std::map<std::string,std::string> expect(datas.lower_bound("key1050"),datas.lower_bound("key1150"));
+        assert(range == expect);
+        assert(table.btree.range("key1150","key1050").size() == 0);
+        assert(table.btree.range("a","z") == datas);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        table.btree.insert("key4","value4");
+        std::vector<std::map<std::string,std::string>> results;
+        table.add_transaction(scan_inserter(&table));
+        table.add_transaction(scan_scanner(&table,&results));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        // the insert waited until the scanner committed, no phantom
+        assert(results.size() == 2);
+        assert(results[0] == results[1]);
+        assert(results[0].size() == 3 && results[0].count("key3") == 0);
+        assert(table.btree.search("key3") == "value3");
+        assert(table.lock_manager.size() == 0);
+        assert(table.lock_manager.range_locks.size() == 0);
+
+        // own writes and snapshots
+        Transaction txn(&table);
+        Transaction reader(&table);
+        reader.begin(true);
+        txn.begin();
+        txn.del("key1");
+        txn.insert("key25","value25");
+        txn.scan("key1","key3");
+        assert(txn.scan_result.size() == 2);
+        assert(txn.scan_result["key25"] == "value25");
+        assert(txn.commit());
+        reader.scan("key1","key3");
+        assert(reader.scan_result.size() == 2);
+        assert(reader.scan_result["key1"] == "value1");
+        assert(reader.commit());
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name,ConcurrencyControl::OCC);
+        table.btree.insert("key1","value1");
+        Transaction txn1(&table);
+        Transaction txn2(&table);
+        txn1.begin();
+        txn2.begin();
+        txn1.scan("key1","key5");
+        txn2.insert("key3","value3");
+        assert(txn2.commit());
+        // key3 appeared in the scanned range
+        txn1.insert("key9","value9");
+        assert(!txn1.commit());
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "scan_test success!" << std::endl;
+}
+
+my_task bulk_transaction(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.select("key9");
+    co_await txn.lock_table(true);
+    co_await txn.del("key1");
+    co_await txn.del("key2");
+    co_yield txn.commit();
+    co_return;
+}
+
+my_task bulk_writer(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.update("key1","value1_new");
+    co_yield txn.commit();
+    co_return;
+}
+
+void table_lock_test(void) {
+    {
+        assert(lock_mode_compatible(LockMode::IS,LockMode::IX));
+        assert(lock_mode_compatible(LockMode::S,LockMode::IS));
+        assert(!lock_mode_compatible(LockMode::S,LockMode::IX));
+        assert(!lock_mode_compatible(LockMode::X,LockMode::IS));
+        assert(lock_mode_combine(LockMode::IS,LockMode::IX) == LockMode::IX);
+        assert(lock_mode_combine(LockMode::IX,LockMode::S) == LockMode::X);
+        assert(lock_mode_combine(LockMode::S,LockMode::IS) == LockMode::S);
+    }
+    {
+        LockManager lock_manager;
+        assert(lock_manager.try_shared_lock("key1",1) == TryLockResult::GetLock);
+        assert(lock_manager.table_lock(1) == LockMode::IS);
+        assert(lock_manager.try_table_lock(LockMode::X,2) == TryLockResult::Abort);
+        assert(lock_manager.try_table_lock(LockMode::X,0) == TryLockResult::Wait);
+        assert(lock_manager.try_exclusive_lock("key2",3) == TryLockResult::GetLock);
+        assert(lock_manager.try_table_lock(LockMode::S,1) == TryLockResult::Wait);
+        lock_manager.unlock("key2",3);
+        lock_manager.finish(3);
+        assert(lock_manager.try_table_lock(LockMode::S,1) == TryLockResult::GetLock);
+        // the table lock covers every key, no new key lock
+        assert(lock_manager.try_shared_lock("key5",1) == TryLockResult::GetLock);
+        assert(lock_manager.size() == 1);
+        assert(lock_manager.try_exclusive_lock("key5",4) == TryLockResult::Abort);
+        assert(lock_manager.try_shared_lock("key5",4) == TryLockResult::GetLock);
+        lock_manager.unlock("key1",1);
+        lock_manager.unlock("key5",1);
+        lock_manager.finish(1);
+        assert(lock_manager.table_lock(1) == std::nullopt);
+    }
+    {
+        LockManager lock_manager;
+        lock_manager.escalation_threshold = 10;
+        for (int i = 0;i < 11; i++) {
+            assert(lock_manager.try_exclusive_lock("key" + std::to_string(i),1) == TryLockResult::GetLock);
+        }
+        // eleven key locks became one table lock
+        assert(lock_manager.size() == 0);
+        assert(lock_manager.table_lock(1) == LockMode::X);
+        assert(lock_manager.stats.escalations == 1);
+        assert(lock_manager.try_shared_lock("key0",2) == TryLockResult::Abort);
+        for (int i = 0;i < 11; i++) {
+            lock_manager.unlock("key" + std::to_string(i),1);
+        }
+        lock_manager.finish(1);
+        assert(lock_manager.table_locks.size() == 0);
+        assert(lock_manager.try_shared_lock("key0",2) == TryLockResult::GetLock);
+        // another reader is in the way, the key locks stay
+        for (int i = 1;i < 12; i++) {
+            assert(lock_manager.try_exclusive_lock("key" + std::to_string(i),3) == TryLockResult::GetLock);
+        }
+        assert(lock_manager.size() == 12);
+        assert(lock_manager.table_lock(3) == LockMode::IX);
+        assert(lock_manager.stats.escalations == 1);
+    }
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        Transaction txn(&table);
+        txn.begin();
+        assert(get<1>(txn.lock_table(true)) == TryLockResult::GetLock);
+        for (int i = 0;i < 100; i++) {
+            txn.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        assert(table.lock_manager.size() == 0);
+        assert(txn.commit());
+        assert(table.btree.all_data().size() == 100);
+        assert(table.lock_manager.table_locks.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.btree.insert("key2","value2");
+        table.btree.insert("key3","value3");
+        // the bulk transaction is older and waits for the writer's IX
+        table.add_transaction(bulk_transaction(&table));
+        table.add_transaction(bulk_writer(&table));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        auto index = table.btree.all_data();
+        assert(index.size() == 1);
+        assert(index["key3"] == "value3");
+        assert(table.lock_manager.size() == 0);
+        assert(table.lock_manager.table_locks.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    std::cerr << "table_lock_test success!" << std::endl;
+}
+
+my_task queue_waiter(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.select("key9");
+    co_await txn.update("key1","value1_waiter");
+    co_yield txn.commit();
+    co_return;
+}
+
+my_task queue_holder(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.update("key1","value1_holder");
+    for (int i = 2;i < 7; i++) {
+        co_await txn.select("key" + std::to_string(i));
+    }
+    co_yield txn.commit();
+    co_return;
+}
+
+void wait_queue_test(void) {
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        // the older waiter is suspended once and retried only after the holder commits
+        table.add_transaction(queue_waiter(&table));
+        table.add_transaction(queue_holder(&table));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        assert(table.lock_manager.stats.waits == 1);
+        assert(table.btree.search("key1") == "value1_waiter");
+        assert(table.lock_manager.blocked.size() == 0);
+        assert(table.lock_manager.woken.size() == 0);
+        assert(table.lock_manager.runnable.size() == 0);
+        assert(table.lock_manager.waiters.size() == 0);
+        remove(btree_file_name.c_str());
+        remove(data_file_name.c_str());
+        remove(log_file_name.c_str());
+    }
+    {
+        LockManager lock_manager(DeadlockPolicy::WoundWait);
+        assert(lock_manager.try_exclusive_lock("key1",1) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key2",2) == TryLockResult::GetLock);
+        assert(lock_manager.try_exclusive_lock("key1",2) == TryLockResult::Wait);
+        lock_manager.block(2,std::noop_coroutine(),[&] { return lock_manager.try_exclusive_lock("key1",2); });
+        lock_manager.grant_woken();
+        assert(lock_manager.runnable.size() == 0);
+        // wounding a blocked transaction wakes it so it can abort
+        assert(lock_manager.try_exclusive_lock("key2",0) == TryLockResult::Wait);
+        lock_manager.grant_woken();
+        assert(lock_manager.blocked.size() == 0);
+        assert(lock_manager.runnable.size() == 1);
+        assert(lock_manager.runnable.front().second == TryLockResult::Abort);
+        lock_manager.runnable.clear();
+        lock_manager.unlock("key2",2);
+        lock_manager.finish(2);
+        // a waiter gets the lock when its holder finishes
+        assert(lock_manager.try_exclusive_lock("key1",3) == TryLockResult::Wait);
+        lock_manager.block(3,std::noop_coroutine(),[&] { return lock_manager.try_exclusive_lock("key1",3); });
+        lock_manager.unlock("key1",1);
+        lock_manager.finish(1);
+        lock_manager.grant_woken();
+        assert(lock_manager.blocked.size() == 0);
+        assert(lock_manager.runnable.size() == 1);
+        assert(lock_manager.runnable.front().second == TryLockResult::GetLock);
+    }
+    std::cerr << "wait_queue_test success!" << std::endl;
+}
+
+my_task stats_transaction(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.insert("key1","value1");
+    co_yield txn.commit();
+    co_return;
+}
+
+my_task stats_reader(Table *table) {
+    Transaction txn(table);
+    co_yield txn.begin();
+    co_await txn.select("key1");
+    co_yield txn.commit();
+    co_return;
+}
+
+void buffer_stats_test(void) {
+    std::string file_name = "buffer_stats_test.txt";
+    {
+        BufferManager buffer_manager(file_name);
+        // every page is read on its own
+        buffer_manager.readahead_pages = 0;
+        for(int i = 0;i < MAX_BUFFER_SIZE + 1; i++) {
+            buffer_manager.create_new_page();
+        }
+        for(int i = 0;i < MAX_BUFFER_SIZE; i++) {
+            buffer_manager.fetch_page(i);
+        }
+        assert(buffer_manager.stats.misses == (unsigned long long)MAX_BUFFER_SIZE);
+        assert(buffer_manager.stats.hits == 0);
+        buffer_manager.write_page(0,"x",checksum_len,1);
+        assert(buffer_manager.stats.hits == 1);
+        buffer_manager.pages[2].pin();
+        assert(buffer_manager.pinned_frames() == 1);
+
+        // the hand clears the access bit of page 0 and takes page 1
+        buffer_manager.fetch_page(MAX_BUFFER_SIZE);
+        assert(buffer_manager.stats.evictions == 1);
+        assert(buffer_manager.stats.dirty_writebacks == 0);
+        assert(buffer_manager.stats.sweep_steps == 2);
+        // page 2 is pinned and skipped
+        buffer_manager.fetch_page(1);
+        assert(buffer_manager.stats.evictions == 2);
+        assert(buffer_manager.stats.sweep_steps == 4);
+        assert(buffer_manager.pagetable.count(3) == 0);
+        buffer_manager.write_page(4,"x",checksum_len,1);
+        buffer_manager.pages[4].access = 0;
+        buffer_manager.fetch_page(3);
+        assert(buffer_manager.stats.evictions == 3);
+        assert(buffer_manager.stats.dirty_writebacks == 1);
+        assert(buffer_manager.stats.max_sweep == 2);
+        buffer_manager.pages[2].unpin();
+        assert(buffer_manager.pinned_frames() == 0);
+    }
+    remove(file_name.c_str());
+
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    std::string stats_file_name = "stats1.txt";
+    remove(stats_file_name.c_str());
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.set_stats_dump(stats_file_name,std::chrono::milliseconds(0));
+        table.add_transaction(stats_transaction(&table));
+        table.exec_transaction();
+        TableStats stats = table.stats();
+        assert(stats.buffer.hits > 0);
+        assert(stats.resident_pages > 0);
+        assert(stats.buffer_size == MAX_BUFFER_SIZE);
+        assert(stats.lock.acquisitions == table.lock_manager.stats.acquisitions);
+
+        std::ifstream stats_file(stats_file_name);
+        std::string line;
+        getline(stats_file,line);
+        assert(line.find("\"hit_ratio\":") != std::string::npos);
+        assert(!getline(stats_file,line));
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    remove(stats_file_name.c_str());
+    {
+        // one closed-loop exec_transaction spanning several dump intervals dumps while it runs
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.set_stats_dump(stats_file_name,std::chrono::milliseconds(5));
+        auto start = std::chrono::steady_clock::now();
+        auto next_task = [&]() -> task_factory {
+            if (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(40)) {
+                return task_factory();
+            }
+            return [&table]{ return stats_reader(&table); };
+        };
+        table.add_transaction(next_task());
+        table.scheduler.next_task = next_task;
+        table.exec_transaction();
+        table.scheduler.next_task = nullptr;
+
+        std::ifstream stats_file(stats_file_name);
+        std::string line;
+        int lines = 0;
+        while (getline(stats_file,line)) {
+            ++lines;
+        }
+        assert(lines >= 3);
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    remove(stats_file_name.c_str());
+    std::cerr << "buffer_stats_test success!" << std::endl;
+}
+
+void profiler_test(void) {
+    {
+        LatencyHistogram histogram;
+        histogram.add(0.5);
+        histogram.add(3);
+        histogram.add(3);
+        histogram.add(100);
+        assert(histogram.count == 4);
+        assert(histogram.buckets[0] == 1);
+        assert(histogram.buckets[2] == 2); // [2,4)
+        assert(histogram.buckets[7] == 1); // [64,128)
+        assert(histogram.percentile(0.5) == 4);
+        assert(histogram.percentile(1) == 100);
+        assert(histogram.max_us == 100);
+    }
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    std::string trace_file_name = "trace1.json";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.profiler.enabled = true;
+        table.profiler.start_trace(trace_file_name);
+        table.add_transaction(queue_waiter(&table));
+        table.add_transaction(queue_holder(&table));
+        auto commit = table.exec_transaction();
+        assert(commit[0] && commit[1]);
+        table.profiler.stop_trace();
+        for (int phase = 0;phase < PHASE_COUNT; phase++) {
+            assert(table.profiler.phases[phase].count == 2);
+        }
+        // the waiter was blocked while the holder ran and committed
+        assert(table.profiler.phases[static_cast<int>(Phase::lock_wait)].sum_us > 0);
+        assert(table.profiler.running.size() == 0);
+
+        std::ifstream trace_file(trace_file_name);
+        std::stringstream trace;
+        trace << trace_file.rdbuf();
+        assert(trace.str().find("{\"traceEvents\":[") == 0);
+        assert(trace.str().find("\"name\":\"lock_wait\"") != std::string::npos);
+        assert(trace.str().find("\"name\":\"log_flush\"") != std::string::npos);
+        assert(trace.str().rfind("]}") != std::string::npos);
+
+        std::stringstream report;
+        table.profiler.report(report);
+        assert(report.str().find("index_apply") != std::string::npos);
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    {
+        // tracing does not turn a disabled profiler on
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.btree.insert("key1","value1");
+        table.profiler.start_trace(trace_file_name);
+        assert(!table.profiler.enabled);
+        table.add_transaction(queue_waiter(&table));
+        table.add_transaction(queue_holder(&table));
+        table.exec_transaction();
+        table.profiler.stop_trace();
+        assert(!table.profiler.enabled);
+        assert(table.profiler.phases[static_cast<int>(Phase::execution)].count == 0);
+        std::ifstream trace_file(trace_file_name);
+        std::stringstream trace;
+        trace << trace_file.rdbuf();
+        assert(trace.str().find("\"name\"") == std::string::npos);
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    remove(trace_file_name.c_str());
+    std::cerr << "profiler_test success!" << std::endl;
+}
+
+void hot_keys_test(void) {
+    {
+        LockManager lock_manager;
+        assert(lock_manager.try_exclusive_lock("key1",1) == TryLockResult::GetLock);
+        assert(lock_manager.hot_keys.keys.size() == 0); // off by default
+        lock_manager.hot_keys.sample_period = 1;
+        assert(lock_manager.try_shared_lock("hot",2) == TryLockResult::GetLock);
+        assert(lock_manager.try_shared_lock("hot",3) == TryLockResult::GetLock);
+        // the older reader waits for the younger one
+        assert(lock_manager.try_upgrade_lock("hot",2) == TryLockResult::Wait);
+        // a younger writer dies
+        assert(lock_manager.try_exclusive_lock("hot",5) == TryLockResult::Abort);
+        assert(lock_manager.try_exclusive_lock("cold",4) == TryLockResult::GetLock);
+
+        KeyContention hot = lock_manager.hot_keys.keys["hot"];
+        assert(hot.acquisitions == 2);
+        assert(hot.waits == 1);
+        assert(hot.aborts == 1);
+        assert(hot.upgrade_conflicts == 1);
+        // the blocked upgrade is one of the waits, it is not scored twice
+        assert(hot.score() == 2);
+        assert(lock_manager.hot_keys.keys["cold"].acquisitions == 1);
+        auto top = lock_manager.hot_keys.top(1);
+        assert(top.size() == 1 && top[0].first == "hot");
+        std::stringstream report;
+        lock_manager.hot_keys.report(report,10);
+        assert(report.str().find("cold") != std::string::npos);
+        for (int txnid = 1;txnid < 6; txnid++) {
+            lock_manager.finish(txnid);
+        }
+    }
+    {
+        // uncontended keys make room for new ones, contended ones stay
+        HotKeys hot_keys;
+        hot_keys.sample_period = 1;
+        ++hot_keys.entry("hot").waits;
+        for (size_t i = 0;i < HOT_KEY_CAPACITY + 10; i++) {
+            hot_keys.acquired("key" + std::to_string(i));
+        }
+        assert(hot_keys.keys.size() <= HOT_KEY_CAPACITY);
+        assert(hot_keys.keys.count("hot") == 1);
+        // sampled: one in four grants is counted
+        HotKeys sampled;
+        sampled.sample_period = 4;
+        for (int i = 0;i < 8; i++) {
+            sampled.acquired("key");
+        }
+        assert(sampled.keys["key"].acquisitions == 2);
+    }
+    std::cerr << "hot_keys_test success!" << std::endl;
+}
+
+void io_stats_test(void) {
+    std::string file_name = "io_stats_test.txt";
+    std::string log_file_name = "io_stats_log.txt";
+    {
+        DiskManager disk_manager(file_name);
+        int pageid = disk_manager.allocate_new_page();
+        Page page = disk_manager.fetch_page(pageid);
+        disk_manager.write_page(pageid,page); // clean, not written
+        page.write("x",checksum_len,1);
+        disk_manager.write_page(pageid,page);
+        disk_manager.flush();
+        assert(disk_manager.io_stats.reads == 1);
+        assert(disk_manager.io_stats.bytes_read == (unsigned long long)PAGESIZE);
+        assert(disk_manager.io_stats.writes == 1);
+        assert(disk_manager.io_stats.bytes_written == (unsigned long long)PAGESIZE);
+        assert(disk_manager.io_stats.syncs == 1);
+        assert(disk_manager.io_stats.sync_latency.count == 1);
+
+        LogManager log_manager(log_file_name);
+        log_manager.log(LogKind::insert,"key","value");
+        log_manager.log(LogKind::commit,"","");
+        log_manager.log_flush();
+        assert(log_manager.io_stats.writes == 2);
+        assert(log_manager.io_stats.bytes_written == log_manager.lsn);
+        assert(log_manager.io_stats.syncs == 1);
+    }
+    remove(file_name.c_str());
+    remove(log_file_name.c_str());
+
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        table.add_transaction(stats_transaction(&table));
+        table.exec_transaction();
+        TableStats stats = table.stats();
+        assert(stats.log_io.writes == 2);
+        // the first commit into an empty log also flushes before it applies
+        assert(stats.log_io.syncs == 2);
+        assert(stats.data_io.syncs == 0);
+        table.checkpointing();
+        stats = table.stats();
+        assert(stats.btree_io.writes > 0);
+        assert(stats.btree_io.syncs > 0);
+        // the dump file is synced before and after the rename
+        assert(stats.data_io.syncs == 2);
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    std::cerr << "io_stats_test success!" << std::endl;
+}
+
+void background_writer_test(void) {
+    std::string file_name = "background_writer_test.txt";
+    {
+        BufferManager buffer_manager(file_name);
+        // read-ahead past page MAX_BUFFER_SIZE - 1 would evict written pages
+        buffer_manager.readahead_pages = 0;
+        for (int i = 0;i < 2 * MAX_BUFFER_SIZE; i++) {
+            buffer_manager.create_new_page();
+        }
+        buffer_manager.start_writer(0.0,std::chrono::milliseconds(1));
+        for (int i = 0;i < MAX_BUFFER_SIZE; i++) {
+            buffer_manager.write_page(i,to_hex(i).c_str(),checksum_len,8);
+        }
+        for (int retry = 0;retry < 5000; retry++) {
+            {
+                auto guard = buffer_manager.latch_guard();
+                if (buffer_manager.dirty_frames() == 0) {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        buffer_manager.stop_writer();
+        assert(buffer_manager.dirty_frames() == 0);
+        assert(buffer_manager.stats.background_writes >= (unsigned long long)MAX_BUFFER_SIZE);
+        // cleaned frames carry the checksum that was written
+        assert(buffer_manager.confirm_checksum(0));
+        // every victim is clean
+        for (int i = MAX_BUFFER_SIZE;i < 2 * MAX_BUFFER_SIZE; i++) {
+            buffer_manager.fetch_page(i);
+        }
+        assert(buffer_manager.stats.evictions == (unsigned long long)MAX_BUFFER_SIZE);
+        assert(buffer_manager.stats.dirty_writebacks == 0);
+        for (int i = 0;i < MAX_BUFFER_SIZE; i++) {
+            const char *buf = buffer_manager.read_page(i,checksum_len,8);
+            assert(strcmp(buf,to_hex(i).c_str()) == 0);
+            free(const_cast<char*>(buf));
+            assert(buffer_manager.confirm_checksum(i));
+        }
+    }
+    remove(file_name.c_str());
+
+    // foreground writes race with the writer
+    std::string btree_file_name = "btree1.txt";
+    {
+        BTree btree(btree_file_name);
+        btree.buffer_manager.start_writer(0.0,std::chrono::milliseconds(0));
+        for (int i = 0;i < 3000; i++) {
+            btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        btree.flush();
+    }
+    {
+        BTree btree(btree_file_name);
+        assert(btree.valid);
+        for (int i = 0;i < 3000; i++) {
+            assert(btree.search("key" + std::to_string(i)) == "value" + std::to_string(i));
+        }
+    }
+    remove(btree_file_name.c_str());
+    std::cerr << "background_writer_test success!" << std::endl;
+}
+
+void replacement_test(void) {
+    std::string file_name = "replacement_test.txt";
+    {
+        BufferManager buffer_manager(file_name);
+        for (int i = 0;i < 4 * MAX_BUFFER_SIZE; i++) {
+            buffer_manager.create_new_page();
+        }
+    }
+    auto touch = [](BufferManager &buffer_manager,int pageid) {
+        free(const_cast<char*>(buffer_manager.read_page(pageid,checksum_len,8)));
+    };
+    const int hot = 100;
+    for (ReplacementPolicy policy : {ReplacementPolicy::Clock,ReplacementPolicy::TwoQ,ReplacementPolicy::ARC}) {
+        BufferManager buffer_manager(file_name,policy);
+        // one page per miss keeps the queue sizes exact
+        buffer_manager.readahead_pages = 0;
+        int next = hot;
+        auto scan = [&](int pages) {
+            for (int i = 0;i < pages; i++) {
+                touch(buffer_manager,next++);
+            }
+        };
+        for (int i = 0;i < hot; i++) {
+            touch(buffer_manager,i);
+        }
+        if (policy == ReplacementPolicy::TwoQ) {
+            // 2Q keeps a page once it comes back after leaving a1in
+            scan(MAX_BUFFER_SIZE);
+            assert(buffer_manager.two_queue.a1out.size() == hot);
+        }
+        for (int i = 0;i < hot; i++) {
+            touch(buffer_manager,i);
+        }
+        scan(2 * MAX_BUFFER_SIZE);
+        int resident = 0;
+        for (int i = 0;i < hot; i++) {
+            resident += buffer_manager.pagetable.count(i);
+        }
+        if (policy == ReplacementPolicy::Clock) {
+            assert(resident == 0);
+        } else {
+            assert(resident == hot);
+        }
+        assert((int)buffer_manager.pagetable.size() == MAX_BUFFER_SIZE);
+        if (policy == ReplacementPolicy::ARC) {
+            assert(buffer_manager.adaptive_cache.t1.size() + buffer_manager.adaptive_cache.t2.size() == MAX_BUFFER_SIZE);
+            assert(buffer_manager.adaptive_cache.t2.size() == hot);
+        }
+        buffer_manager.discard();
+        assert(buffer_manager.pagetable.size() == 0);
+        assert(buffer_manager.two_queue.am.size() == 0);
+        assert(buffer_manager.adaptive_cache.t2.size() == 0);
+    }
+    remove(file_name.c_str());
+
+    std::string btree_file_name = "btree1.txt";
+    std::string value(300,'v');
+    for (ReplacementPolicy policy : {ReplacementPolicy::TwoQ,ReplacementPolicy::ARC}) {
+        {
+            BTree btree(btree_file_name,policy);
+            for (int i = 0;i < 15000; i++) {
+                btree.insert("key" + std::to_string(i),value + std::to_string(i));
+            }
+            assert(btree.buffer_manager.stats.evictions > 0);
+            for (int i = 0;i < 15000; i += 7) {
+                assert(btree.search("key" + std::to_string(i)) == value + std::to_string(i));
+            }
+        }
+        {
+            BTree btree(btree_file_name,policy);
+            assert((int)btree.all_data().size() == 15000);
+        }
+        if (policy == ReplacementPolicy::ARC) {
+            // the field reads of one node visit are one reference
+            BTree btree(btree_file_name,policy);
+            AdaptiveCache &adaptive_cache = btree.buffer_manager.adaptive_cache;
+            assert(btree.search("key777"));
+            assert(adaptive_cache.t2.size() == 0);
+            assert(btree.search("key777"));
+            assert(adaptive_cache.t2.size() > 0);
+        }
+        remove(btree_file_name.c_str());
+    }
+    std::cerr << "replacement_test success!" << std::endl;
+}
+
+void flush_test(void) {
+    std::string file_name = "flush_test.txt";
+    {
+        BufferManager buffer_manager(file_name);
+        for (int i = 0;i < 10; i++) {
+            buffer_manager.create_new_page();
+        }
+        for (int pageid : {8,2,5}) {
+            buffer_manager.write_page(pageid,to_hex(pageid).c_str(),checksum_len,8);
+        }
+        buffer_manager.fetch_page(3);
+        buffer_manager.flush_range(0,5);
+        IOStats &io_stats = buffer_manager.disk_manager.io_stats;
+        assert(io_stats.writes == 1);
+        assert(!buffer_manager.pages[buffer_manager.pagetable[2]].dirty);
+        assert(buffer_manager.pages[buffer_manager.pagetable[5]].dirty);
+        buffer_manager.flush();
+        assert(io_stats.writes == 3);
+        // clean frames are not written again
+        buffer_manager.flush();
+        assert(io_stats.writes == 3);
+        // and stay cached
+        assert(buffer_manager.pagetable.size() == 4);
+        unsigned long long misses = buffer_manager.stats.misses;
+        for (int pageid : {2,3,5,8}) {
+            assert(buffer_manager.confirm_checksum(pageid) || pageid == 3);
+        }
+        assert(buffer_manager.stats.misses == misses);
+    }
+    {
+        BufferManager buffer_manager(file_name);
+        for (int pageid : {2,5,8}) {
+            const char *buf = buffer_manager.read_page(pageid,checksum_len,8);
+            assert(strcmp(buf,to_hex(pageid).c_str()) == 0);
+            free(const_cast<char*>(buf));
+            assert(buffer_manager.confirm_checksum(pageid));
+        }
+    }
+    remove(file_name.c_str());
+
+    std::string btree_file_name = "btree1.txt";
+    std::string data_file_name = "data1.txt";
+    std::string log_file_name = "log1.txt";
+    {
+        Table table(btree_file_name,data_file_name,log_file_name);
+        for (int i = 0;i < 1000; i++) {
+            table.btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        // a checkpoint leaves the cache warm
+        table.checkpointing();
+        unsigned long long misses = table.btree.buffer_manager.stats.misses;
+        for (int i = 0;i < 1000; i++) {
+            assert(table.btree.search("key" + std::to_string(i)));
+        }
+        assert(table.btree.buffer_manager.stats.misses == misses);
+
+        // clear drops the frames of the truncated file
+        table.btree.clear();
+        assert(table.btree.buffer_manager.disk_manager.page_num == 2);
+        assert((int)table.btree.buffer_manager.pagetable.size() <= 2);
+        assert(table.btree.search("key1") == std::nullopt);
+        table.btree.insert("key1","value1");
+        assert(table.btree.search("key1") == "value1");
+    }
+    remove(btree_file_name.c_str());
+    {
+        // clear forgets a pool full of dirty frames, the writer started
+        // afterwards must not write them over the new file
+        BTree btree(btree_file_name);
+        for (int i = 0;i < 5000; i++) {
+            btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        btree.clear();
+        btree.insert("key1","value1");
+        btree.buffer_manager.start_writer(0.0,std::chrono::milliseconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        btree.buffer_manager.stop_writer();
+        int page_num = btree.buffer_manager.disk_manager.page_num;
+        file_size_check(btree_file_name,page_num * PAGESIZE);
+        btree.flush();
+    }
+    {
+        BTree btree(btree_file_name);
+        assert(btree.valid);
+        assert(btree.all_data().size() == 1);
+        assert(btree.search("key1") == "value1");
+    }
+    remove(btree_file_name.c_str());
+    remove(data_file_name.c_str());
+    remove(log_file_name.c_str());
+    std::cerr << "flush_test success!" << std::endl;
+}
+
+void readahead_test(void) {
+    std::string file_name = "readahead_test.txt";
+    const int pages = 200;
+    {
+        BufferManager buffer_manager(file_name);
+        for (int i = 0;i < pages; i++) {
+            buffer_manager.create_new_page();
+            buffer_manager.write_page(i,to_hex(i).c_str(),checksum_len,8);
+        }
+        buffer_manager.flush();
+    }
+    auto read_all = [&](BufferManager &buffer_manager) {
+        for (int i = 0;i < pages; i++) {
+            const char *buf = buffer_manager.read_page(i,checksum_len,8);
+            assert(strcmp(buf,to_hex(i).c_str()) == 0);
+            free(const_cast<char*>(buf));
+            assert(buffer_manager.confirm_checksum(i));
+        }
+    };
+    {
+        // the second miss in a row reads an extent
+        BufferManager buffer_manager(file_name);
+        read_all(buffer_manager);
+        BufferStats &stats = buffer_manager.stats;
+        assert(stats.readahead_ios > 0);
+        assert(stats.misses + stats.readahead_pages == pages);
+        assert(stats.readahead_hits == stats.readahead_pages);
+        assert(buffer_manager.disk_manager.io_stats.reads == stats.misses);
+        assert(stats.misses < pages / READAHEAD_PAGES + 8);
+    }
+    {
+        BufferManager buffer_manager(file_name);
+        buffer_manager.readahead_pages = 0;
+        read_all(buffer_manager);
+        assert(buffer_manager.stats.readahead_ios == 0);
+        assert(buffer_manager.disk_manager.io_stats.reads == pages);
+    }
+    {
+        // a hint is read in runs of consecutive missing pages, lone pages are left
+        BufferManager buffer_manager(file_name);
+        buffer_manager.fetch_page(8);
+        buffer_manager.read_ahead({20,7,5,8,6,9});
+        assert(buffer_manager.stats.readahead_ios == 1);
+        assert(buffer_manager.stats.readahead_pages == 3);
+        assert(buffer_manager.disk_manager.io_stats.reads == 2);
+        assert(buffer_manager.pagetable.count(9) == 0);
+        assert(buffer_manager.pagetable.count(20) == 0);
+        unsigned long long misses = buffer_manager.stats.misses;
+        for (int pageid : {5,6,7}) {
+            buffer_manager.fetch_page(pageid);
+        }
+        assert(buffer_manager.stats.misses == misses);
+        assert(buffer_manager.stats.readahead_hits == 3);
+    }
+    remove(file_name.c_str());
+
+    std::string btree_file_name = "btree1.txt";
+    {
+        BTree btree(btree_file_name);
+        for (int i = 0;i < 5000; i++) {
+            btree.insert("key" + std::to_string(i),"value" + std::to_string(i));
+        }
+        btree.flush();
+    }
+    {
+        // a cold scan reads the children of each node together
+        BTree btree(btree_file_name);
+        auto datas = btree.all_data();
+        assert(datas.size() == 5000);
+        assert(datas["key1234"] == "value1234");
+        BufferStats &stats = btree.buffer_manager.stats;
+        assert(stats.readahead_ios > 0);
+        assert(stats.readahead_hits > 0);
+        assert(btree.buffer_manager.disk_manager.io_stats.reads < (unsigned long long)btree.buffer_manager.disk_manager.page_num);
+        assert(btree.range("key100","key101").size() == 11);
+    }
+    remove(btree_file_name.c_str());
+    std::cerr << "readahead_test success!" << std::endl;
+}
+
 int main() {
     util_test();
     log_test();
@@ -787,10 +2179,26 @@ int main() {
     buffer_manager_test();
     node_test();
     btree_ondisk_test();
+    superblock_test();
     lock_manager_test();
     table_test();
     transaction_test();
     concurrent_test();
+    snapshot_test();
+    occ_test();
+    deadlock_policy_test();
+    retry_test();
+    scan_test();
+    table_lock_test();
+    wait_queue_test();
+    buffer_stats_test();
+    profiler_test();
+    hot_keys_test();
+    io_stats_test();
+    background_writer_test();
+    replacement_test();
+    flush_test();
+    readahead_test();
     std::cerr << "all test success!" << std::endl;
     return 0;
 }
\ No newline at end of file
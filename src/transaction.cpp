@@ -2,84 +2,154 @@
 
 Transaction::Transaction(Table *table)
     :table(table),
-     write_set({}),
+     write_set(&arena.resource),
+     read_set(&arena.resource),
+     read_ts(&arena.resource),
      conditional_write_error(false),
-     txnid(-1)
+     read_only_error(false),
+     txnid(-1),
+     read_only(false),
+     occ(false),
+     snapshot_ts(0)
 {
-    table->scheduler.transactions.push_back(this);
+    table->scheduler.register_transaction(this);
     // table->tasksに同じtxnidのmy_taskがいる。
 }
 
+Arena::Arena()
+    :resource(initial,sizeof(initial)) {}
+
+std::string_view Arena::store(std::string_view s) {
+    char *p = static_cast<char*>(resource.allocate(s.size(),1));
+    memcpy(p,s.data(),s.size());
+    return std::string_view(p,s.size());
+}
+
+// the next transaction starts again from initial
+void Arena::release(void) {
+    resource.release();
+}
+
 int fresh_txnid(void) {
     static int fresh = 0;
     return fresh++;
 }
 
-int Transaction::begin() {
-    txnid = fresh_txnid();
+int Transaction::begin(bool read_only_) {
+    txnid = table->scheduler.txnid();
+    read_only = read_only_;
+    conditional_write_error = false;
+    read_only_error = false;
+    occ = !read_only && table->concurrency_control == ConcurrencyControl::OCC;
+    if (read_only) {
+        snapshot_ts = table->version_store.begin_snapshot();
+    } else if (occ) {
+        snapshot_ts = table->version_store.begin_occ();
+    }
     return txnid;
 }
 
 bool Transaction::commit() {
 
-    // confirm conditional write
-    for(auto [key,data_write] : write_set) {
-        auto [first_data_state, _, value] = data_write;
-        if ( (table->btree.search(key) == std::nullopt && first_data_state == DataState::in_keys) ||
-             (table->btree.search(key) != std::nullopt && first_data_state == DataState::not_in_keys) ) {
-            conditional_write_error = true;
-        }
-        (void)_;
+    if (read_only) {
+        unlock();
+        return true;
     }
 
-    if (conditional_write_error) {
+    if (occ && !validate()) {
         rollback();
         return false;
     }
 
+    // nothing written: no conditional write to confirm, no log record, no flush
+    if (write_set.empty()) {
+        unlock();
+        return true;
+    }
+
+    Profiler &profiler = table->profiler;
+    LogManager &log_manager = table->log_manager;
+
     // write ahead log
-    for (auto [key,data_write]:write_set) {
-        auto [_, last_ope_kind, value] = data_write;
+    auto log_start = profiler.now();
+    bool log_was_empty = log_manager.empty;
+    for (auto &[key,data_write] : write_set) {
+        OpeKind last_ope_kind = data_write.last_ope_kind;
+        std::optional<std::string_view> value = data_write.value;
         if (last_ope_kind == OpeKind::insert) {
             assert(value);
-            table->log_manager.log(LogKind::insert,key,value.value());
+            log_manager.log(LogKind::insert,key,value.value());
         } else if (last_ope_kind == OpeKind::update) {
             assert(value);
-            table->log_manager.log(LogKind::update,key,value.value());
+            log_manager.log(LogKind::update,key,value.value());
         } else {
             assert(last_ope_kind == OpeKind::del);
-            table->log_manager.log(LogKind::del,key,"");
+            log_manager.log(LogKind::del,key,"");
         }
-        (void)_;
     }
-    table->log_manager.log(LogKind::commit,"","");
-    
-    // flush
-    table->log_manager.log_flush();
+    if (log_was_empty) {
+        // recovery trusts the btree file while the log file is empty. the records
+        // reach the file before a page they change can, so it rebuilds instead
+        log_manager.log_flush();
+    }
+    auto apply_start = profiler.now();
+    profiler.record(txnid,Phase::log_append,log_start,apply_start);
 
-    // update btree index
-    // conditional write
-    for(auto [key,data_write] : write_set) {
-        auto [ _, last_ope_kind, value] = data_write;
-        if (last_ope_kind == OpeKind::insert) {
-            assert(value);
-            if (table->btree.search(key) == std::nullopt) {
-                table->btree.insert(key,value.value());
-            } else {
-                table->btree.update(key,value.value());
+    // update btree index, one descent per key. the old value it returns
+    // confirms the conditional write
+    std::vector<std::optional<std::string>> old_values;
+    old_values.reserve(write_set.size());
+    for (auto &[key,data_write] : write_set) {
+        if (data_write.last_ope_kind == OpeKind::del) {
+            old_values.push_back(table->btree.erase(key));
+        } else {
+            assert(data_write.value);
+            old_values.push_back(table->btree.upsert(key,data_write.value.value()));
+        }
+        DataState data_state = old_values.back() ? DataState::in_keys : DataState::not_in_keys;
+        if (data_state != data_write.first_data_state) {
+            conditional_write_error = true;
+            break;
+        }
+    }
+    auto flush_start = profiler.now();
+    profiler.record(txnid,Phase::index_apply,apply_start,flush_start);
+
+    if (conditional_write_error) {
+        // put the old values back and void the records
+        size_t i = 0;
+        for (auto &[key,data_write] : write_set) {
+            if (i == old_values.size()) {
+                break;
             }
-        } else if (last_ope_kind == OpeKind::update) {
-            assert(value);
-            if (table->btree.search(key) == std::nullopt) {
-                table->btree.insert(key,value.value());
+            if (old_values[i]) {
+                table->btree.upsert(key,old_values[i].value());
             } else {
-                table->btree.update(key,value.value());
+                table->btree.erase(key);
             }
-        } else {
-            assert(last_ope_kind == OpeKind::del);
-            table->btree.del(key);
+            ++i;
+        }
+        log_manager.log(LogKind::abort,"","");
+        rollback();
+        return false;
+    }
+
+    log_manager.log(LogKind::commit,"","");
+    log_manager.log_flush();
+    profiler.record(txnid,Phase::log_flush,flush_start,profiler.now());
+
+    // snapshots and OCC validation see the commit
+    unsigned long long ts = table->version_store.next_commit_ts();
+    bool has_snapshot = table->version_store.has_snapshot();
+    size_t i = 0;
+    for (auto &[key,data_write] : write_set) {
+        if (has_snapshot) {
+            table->version_store.record(key,ts,old_values[i]);
+        }
+        if (occ) {
+            table->version_store.record_write(key,ts);
         }
-        (void)_;
+        ++i;
     }
 
     // SS2PL
@@ -87,69 +157,122 @@ bool Transaction::commit() {
     return true;
 }
 
+// OCC read validation
+// every key read must not have been overwritten by a commit after the read
+bool Transaction::validate(void) {
+    for (auto &[key,ts] : read_ts) {
+        if (table->version_store.last_write_ts(key) > ts) {
+            return false;
+        }
+    }
+    // a commit inside a scanned range may have added a phantom
+    for (auto &[low,high,ts] : scan_ts) {
+        if (table->version_store.last_write_ts(low,high) > ts) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool Transaction::rollback() {
     unlock();
     return false;
 }
 
 void Transaction::unlock() {
-    for (auto [key, _] : write_set) {
-        table->lock_manager.unlock(key,txnid);
-        (void)_;
-    }
-    for (auto [key, _] : read_set) {
-        table->lock_manager.unlock(key,txnid);
-        (void)_;
+    if (read_only) {
+        // snapshot reads hold no locks
+        table->version_store.end_snapshot(snapshot_ts);
+        read_only = false;
+    } else if (occ) {
+        // optimistic transactions hold no locks
+        table->version_store.end_occ(snapshot_ts);
+        occ = false;
+        scan_ts.clear();
+    } else {
+        for (auto &entry : write_set) {
+            table->lock_manager.unlock(entry.first,txnid);
+        }
+        for (auto &entry : read_set) {
+            table->lock_manager.unlock(entry.first,txnid);
+        }
+        table->lock_manager.finish(txnid);
     }
-    write_set.clear();
-    read_set.clear();
+    scan_result.clear();
+    release();
+}
+
+// drop the sets and free the arena under them
+void Transaction::release(void) {
+    // clear() would keep the bucket arrays, which live in the arena
+    write_set = WriteSet(&arena.resource);
+    read_set = ReadSet(&arena.resource);
+    read_ts = std::pmr::unordered_map<std::string_view,unsigned long long>(&arena.resource);
+    arena.release();
 }
 
-result Transaction::select(const std::string &key) {
+// the arguments are taken by value and moved into the DataOperation,
+// a key passed as a temporary is never copied
+result Transaction::select(std::string key) {
     auto try_lock_result = select_internal(key);
-    DataOperation data_operation = DataOperation(OpeKind::select,key,"");
-    return std::make_tuple(this,try_lock_result,data_operation);
+    return result(this,try_lock_result,DataOperation(OpeKind::select,std::move(key),{}));
 }
 
-result Transaction::insert(const std::string &key,const std::string &value) {
+result Transaction::insert(std::string key,std::string value) {
     auto try_lock_result = insert_internal(key,value);
-    DataOperation data_operation = DataOperation(OpeKind::insert,key,value);
-    return std::make_tuple(this,try_lock_result,data_operation);
+    return result(this,try_lock_result,DataOperation(OpeKind::insert,std::move(key),std::move(value)));
 }
 
-result Transaction::update(const std::string &key,const std::string &value) {
+result Transaction::update(std::string key,std::string value) {
     auto try_lock_result = update_internal(key,value);
-    DataOperation data_operation = DataOperation(OpeKind::update,key,value);
-    return std::make_tuple(this,try_lock_result,data_operation);
+    return result(this,try_lock_result,DataOperation(OpeKind::update,std::move(key),std::move(value)));
 }
     
-result Transaction::del(const std::string &key) {
+result Transaction::del(std::string key) {
     auto try_lock_result = del_internal(key);
-    DataOperation data_operation = DataOperation(OpeKind::del,key,"");
-    return std::make_tuple(this,try_lock_result,data_operation);
+    return result(this,try_lock_result,DataOperation(OpeKind::del,std::move(key),{}));
+}
+
+// low <= key < high, the result is left in scan_result
+result Transaction::scan(std::string low,std::string high) {
+    auto try_lock_result = scan_internal(low,high);
+    return result(this,try_lock_result,DataOperation(OpeKind::scan,std::move(low),std::move(high)));
+}
+
+// one S or X lock on the whole table instead of a lock per key, for bulk operations
+result Transaction::lock_table(bool exclusive) {
+    auto try_lock_result = lock_table_internal(exclusive);
+    return result(this,try_lock_result,DataOperation(OpeKind::lock_table,exclusive ? "X" : "S",{}));
 }
 
 std::optional<std::string> Transaction::get_value(const std::string &key) {
-    if (read_set.count(key) > 0) {
-        return read_set[key];
-    } else if (write_set.count(key) > 0) {
-        if (write_set[key].last_ope_kind != OpeKind::del) {
-            return write_set[key].value;
-        } else {
-            return std::nullopt;
-        }
+    std::optional<std::string_view> value;
+    if (auto it = read_set.find(key); it != read_set.end()) {
+        value = it->second;
+    } else if (auto it = write_set.find(key); it != write_set.end()) {
+        value = it->second.value;
+    } else {
+        assert(false);
     }
-    assert(false);
+    return value ? std::optional<std::string>(value.value()) : std::nullopt;
 }
 
 TryLockResult Transaction::select_internal(const std::string &key) {
     if (read_set.count(key) > 0 || write_set.count(key) > 0) {
         return TryLockResult::GetLock;
+    } else if (read_only) {
+        read_set.emplace(arena.store(key),store(table->version_store.read(key,snapshot_ts,table->btree)));
+        return TryLockResult::GetLock;
+    } else if (occ) {
+        std::string_view name = arena.store(key);
+        read_set.emplace(name,store(table->btree.search(key)));
+        read_ts.emplace(name,table->version_store.commit_ts);
+        return TryLockResult::GetLock;
     } else {
         TryLockResult res = table->lock_manager.try_shared_lock(key,txnid);
         switch (res) {
             case TryLockResult::GetLock:
-                read_set[key] = table->btree.search(key);
+                read_set.emplace(arena.store(key),store(table->btree.search(key)));
                 break;
             case TryLockResult::Abort:
                 rollback();   
@@ -162,21 +285,53 @@ TryLockResult Transaction::select_internal(const std::string &key) {
     }
 }
 
+std::optional<std::string_view> Transaction::store(const std::optional<std::string> &value) {
+    if (!value) {
+        return std::nullopt;
+    }
+    return arena.store(value.value());
+}
+
+// first write to key, a key read before moves from read_set with its stored copy
+void Transaction::add_write(const std::string &key,DataWrite &&data_write) {
+    auto it = read_set.find(key);
+    if (it != read_set.end()) {
+        write_set.emplace(it->first,std::move(data_write));
+        read_set.erase(it);
+    } else {
+        write_set.emplace(arena.store(key),std::move(data_write));
+    }
+}
+
+// a read-only transaction holds no locks and its snapshot is not the latest
+// state, so a write in it aborts the transaction
+TryLockResult Transaction::reject_write(void) {
+    read_only_error = true;
+    rollback();
+    return TryLockResult::Abort;
+}
+
 TryLockResult Transaction::insert_internal(const std::string &key,const std::string &value) {
-    if (write_set.count(key) > 0 && write_set[key].last_ope_kind != OpeKind::del) {
+    if (read_only) {
+        return reject_write();
+    }
+    auto it = write_set.find(key);
+    if (it != write_set.end() && it->second.last_ope_kind != OpeKind::del) {
         conditional_write_error = true;
+        rollback();
         return TryLockResult::Abort;
-    } else if (write_set.count(key) > 0) {
-        write_set[key] = DataWrite(write_set[key].first_data_state,OpeKind::insert,value);
+    } else if (it != write_set.end()) {
+        it->second.last_ope_kind = OpeKind::insert;
+        it->second.value = arena.store(value);
         return TryLockResult::GetLock;
     } else {
         // read_set.count(key) > 0 ||
         // read_set.count(key) == 0 && write_set.count(key) == 0
-        TryLockResult res = table->lock_manager.try_exclusive_lock(key,txnid);
+        // OCC buffers the write without locking, read_ts keeps validating a key read before
+        TryLockResult res = occ ? TryLockResult::GetLock : table->lock_manager.try_exclusive_lock(key,txnid);
         switch (res) {
             case TryLockResult::GetLock:
-                read_set.erase(key);
-                write_set[key] = DataWrite(DataState::not_in_keys,OpeKind::insert,value);
+                add_write(key,DataWrite(DataState::not_in_keys,OpeKind::insert,arena.store(value)));
                 break;
             case TryLockResult::Abort:
                 rollback();
@@ -190,20 +345,25 @@ TryLockResult Transaction::insert_internal(const std::string &key,const std::str
 }
 
 TryLockResult Transaction::update_internal(const std::string &key,const std::string &value) {
-    if (write_set.count(key) > 0 && write_set[key].last_ope_kind == OpeKind::del) {
+    if (read_only) {
+        return reject_write();
+    }
+    auto it = write_set.find(key);
+    if (it != write_set.end() && it->second.last_ope_kind == OpeKind::del) {
         conditional_write_error = true;
+        rollback();
         return TryLockResult::Abort;
-    } else if (write_set.count(key) > 0) {
-        write_set[key] = DataWrite(write_set[key].first_data_state,OpeKind::update,value);
+    } else if (it != write_set.end()) {
+        it->second.last_ope_kind = OpeKind::update;
+        it->second.value = arena.store(value);
         return TryLockResult::GetLock;
     } else {
         // read_set.count(key) > 0 ||
         // read_set.count(key) == 0 && write_set.count(key) == 0
-        TryLockResult res = table->lock_manager.try_exclusive_lock(key,txnid);
+        TryLockResult res = occ ? TryLockResult::GetLock : table->lock_manager.try_exclusive_lock(key,txnid);
         switch (res) {
             case TryLockResult::GetLock:
-                read_set.erase(key);
-                write_set[key] = DataWrite(DataState::in_keys,OpeKind::update,value);
+                add_write(key,DataWrite(DataState::in_keys,OpeKind::update,arena.store(value)));
                 break;
             case TryLockResult::Abort:
                 rollback();
@@ -217,20 +377,25 @@ TryLockResult Transaction::update_internal(const std::string &key,const std::str
 }
 
 TryLockResult Transaction::del_internal(const std::string &key) {
-    if (write_set.count(key) > 0 && write_set[key].last_ope_kind == OpeKind::del) {
+    if (read_only) {
+        return reject_write();
+    }
+    auto it = write_set.find(key);
+    if (it != write_set.end() && it->second.last_ope_kind == OpeKind::del) {
         conditional_write_error = true;
+        rollback();
         return TryLockResult::Abort;
-    } else if (write_set.count(key) > 0) {
-        write_set[key] = DataWrite(write_set[key].first_data_state,OpeKind::del,std::nullopt);
+    } else if (it != write_set.end()) {
+        it->second.last_ope_kind = OpeKind::del;
+        it->second.value = std::nullopt;
         return TryLockResult::GetLock;
     } else {
         // read_set.count(key) > 0 ||
         // read_set.count(key) == 0 && write_set.count(key) == 0
-        TryLockResult res = table->lock_manager.try_exclusive_lock(key,txnid);
+        TryLockResult res = occ ? TryLockResult::GetLock : table->lock_manager.try_exclusive_lock(key,txnid);
         switch (res) {
             case TryLockResult::GetLock:
-                read_set.erase(key);
-                write_set[key] = DataWrite(DataState::in_keys,OpeKind::del,std::nullopt);
+                add_write(key,DataWrite(DataState::in_keys,OpeKind::del,std::nullopt));
                 break;
             case TryLockResult::Abort:
                 rollback();
@@ -243,4 +408,83 @@ TryLockResult Transaction::del_internal(const std::string &key) {
     }
 }
 
+TryLockResult Transaction::scan_internal(const std::string &low,const std::string &high) {
+    if (read_only) {
+        scan_result = table->version_store.range(low,high,snapshot_ts,table->btree);
+        return TryLockResult::GetLock;
+    }
+    // S2PL locks the range so no other transaction can insert into it until commit
+    TryLockResult res = occ ? TryLockResult::GetLock : table->lock_manager.try_range_lock(low,high,txnid);
+    switch (res) {
+        case TryLockResult::GetLock:
+            if (occ) {
+                scan_ts.emplace_back(low,high,table->version_store.commit_ts);
+            }
+            scan_result = table->btree.range(low,high);
+            // own writes are visible to the transaction itself
+            for (auto &[key,data_write] : write_set) {
+                if (key < low || high <= key) {
+                    continue;
+                }
+                if (data_write.last_ope_kind == OpeKind::del) {
+                    scan_result.erase(std::string(key));
+                } else {
+                    assert(data_write.value);
+                    scan_result[std::string(key)] = std::string(data_write.value.value());
+                }
+            }
+            break;
+        case TryLockResult::Abort:
+            rollback();
+            break;
+        case TryLockResult::Wait:
+        default:
+            break;
+    }
+    return res;
+}
+
+TryLockResult Transaction::lock_table_internal(bool exclusive) {
+    if (read_only && exclusive) {
+        return reject_write();
+    }
+    if (read_only || occ) {
+        // neither takes locks
+        return TryLockResult::GetLock;
+    }
+    TryLockResult res = table->lock_manager.try_table_lock(exclusive ? LockMode::X : LockMode::S,txnid);
+    if (res == TryLockResult::Abort) {
+        rollback();
+    }
+    return res;
+}
 
+// the request a waiting coroutine suspended on, tried again by LockManager::grant_woken
+TryLockResult Transaction::retry(const DataOperation &data_operation) {
+    const auto &[ope_kind,key,value] = data_operation;
+    switch (ope_kind) {
+        case OpeKind::select:
+            return select_internal(key);
+        case OpeKind::insert:
+            return insert_internal(key,value);
+        case OpeKind::update:
+            return update_internal(key,value);
+        case OpeKind::del:
+            return del_internal(key);
+        case OpeKind::scan:
+            return scan_internal(key,value);
+        case OpeKind::lock_table:
+            return lock_table_internal(key == "X");
+        default:
+            assert(false);
+    }
+}
+
+// data_operation lives in the promise, it outlives the suspension
+void my_task::promise_type::awaiter::block(std::coroutine_handle<> h) {
+    Transaction *txn_ = txn;
+    const DataOperation *data_operation_ = data_operation;
+    txn->table->lock_manager.block(txn->txnid,h,[txn_,data_operation_] {
+        return txn_->retry(*data_operation_);
+    });
+}
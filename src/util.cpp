@@ -64,14 +64,16 @@ unsigned int from_hex(const std::string &s) {
     return number;
 }
 
-void file_sync(const std::string &file_name) {
+void file_sync(const std::string &file_name,IOStats &io_stats) {
     int fd = open(file_name.c_str(),O_WRONLY|O_APPEND);
     if (fd == -1) {
         error("open(data_file)");
     }
+    auto start = std::chrono::steady_clock::now();
     if (fsync(fd) == -1) {
         error("fsync(data_file)");
     } 
+    io_stats.add_sync(elapsed_us(start));
     if (close(fd) == -1) {
         error("close(data_file)");
     }
@@ -91,6 +93,67 @@ unsigned int file_size(const std::string &file_name) {
     return size;
 }
 
+LatencyHistogram::LatencyHistogram()
+    :buckets(),
+     count(0),
+     sum_us(0),
+     max_us(0) {}
+
+void LatencyHistogram::add(double us) {
+    int bucket = std::min(HISTOGRAM_BUCKETS - 1,(int)std::bit_width((unsigned long long)us));
+    ++buckets[bucket];
+    ++count;
+    sum_us += us;
+    max_us = std::max(max_us,us);
+}
+
+double LatencyHistogram::mean(void) const {
+    return count == 0 ? 0 : sum_us / count;
+}
+
+double LatencyHistogram::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long long rank = std::max(1ULL,(unsigned long long)(p * count + 0.5));
+    unsigned long long seen = 0;
+    for (int i = 0;i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(max_us,(double)(1ULL << i));
+        }
+    }
+    return max_us;
+}
+
+double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+IOStats::IOStats()
+    :reads(0),
+     writes(0),
+     syncs(0),
+     bytes_read(0),
+     bytes_written(0) {}
+
+void IOStats::add_read(size_t bytes,double us) {
+    ++reads;
+    bytes_read += bytes;
+    read_latency.add(us);
+}
+
+void IOStats::add_write(size_t bytes,double us) {
+    ++writes;
+    bytes_written += bytes;
+    write_latency.add(us);
+}
+
+void IOStats::add_sync(double us) {
+    ++syncs;
+    sync_latency.add(us);
+}
+
 void error(const char *s) {
     perror(s);
     exit(1);
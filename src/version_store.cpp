@@ -0,0 +1,130 @@
+#include "db.hpp"
+
+VersionStore::VersionStore()
+    :commit_ts(0) {}
+
+unsigned long long VersionStore::begin_snapshot(void) {
+    snapshots.insert(commit_ts);
+    return commit_ts;
+}
+
+void VersionStore::end_snapshot(unsigned long long snapshot_ts) {
+    assert(snapshots.count(snapshot_ts) > 0);
+    unsigned long long oldest = *snapshots.begin();
+    snapshots.erase(snapshots.find(snapshot_ts));
+    // versions become garbage only when the oldest snapshot moves forward
+    if (snapshots.empty() || *snapshots.begin() != oldest) {
+        gc();
+    }
+}
+
+bool VersionStore::has_snapshot(void) {
+    return !snapshots.empty();
+}
+
+unsigned long long VersionStore::next_commit_ts(void) {
+    return ++commit_ts;
+}
+
+// called before the commit with timestamp ts overwrites key
+void VersionStore::record(std::string_view key,unsigned long long ts,const std::optional<std::string> &value) {
+    auto it = undo.find(key);
+    if (it == undo.end()) {
+        it = undo.emplace(std::string(key),std::deque<Version>()).first;
+    }
+    it->second.push_back(Version{ts,value});
+}
+
+// value of key as of snapshot_ts
+// the oldest write committed after the snapshot holds the value the snapshot saw
+std::optional<std::string> VersionStore::read(const std::string &key,unsigned long long snapshot_ts,BTree &btree) {
+    auto it = undo.find(key);
+    if (it != undo.end()) {
+        for (const Version &version : it->second) {
+            if (version.ts > snapshot_ts) {
+                return version.value;
+            }
+        }
+    }
+    return btree.search(key);
+}
+
+// low <= key < high as of snapshot_ts
+std::map<std::string,std::string> VersionStore::range(const std::string &low,const std::string &high,unsigned long long snapshot_ts,BTree &btree) {
+    std::map<std::string,std::string> datas = btree.range(low,high);
+    for (auto it = undo.lower_bound(low); it != undo.end() && it->first < high; ++it) {
+        for (const Version &version : it->second) {
+            if (version.ts > snapshot_ts) {
+                if (version.value.has_value()) {
+                    datas[it->first] = version.value.value();
+                } else {
+                    datas.erase(it->first);
+                }
+                break;
+            }
+        }
+    }
+    return datas;
+}
+
+// drop versions no running snapshot can see
+void VersionStore::gc(void) {
+    if (snapshots.empty()) {
+        undo.clear();
+        return;
+    }
+    unsigned long long oldest = *snapshots.begin();
+    for (auto it = undo.begin(); it != undo.end(); ) {
+        auto &versions = it->second;
+        while (!versions.empty() && versions.front().ts <= oldest) {
+            versions.pop_front();
+        }
+        if (versions.empty()) {
+            it = undo.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+unsigned long long VersionStore::begin_occ(void) {
+    occ_txns.insert(commit_ts);
+    return commit_ts;
+}
+
+void VersionStore::end_occ(unsigned long long begin_ts) {
+    assert(occ_txns.count(begin_ts) > 0);
+    occ_txns.erase(occ_txns.find(begin_ts));
+    if (occ_txns.empty()) {
+        write_ts.clear();
+    }
+}
+
+void VersionStore::record_write(std::string_view key,unsigned long long ts) {
+    if (occ_txns.empty()) {
+        return;
+    }
+    auto it = write_ts.find(key);
+    if (it == write_ts.end()) {
+        write_ts.emplace(std::string(key),ts);
+    } else {
+        it->second = ts;
+    }
+}
+
+// 0 if key has not been written since the oldest running OCC transaction began
+unsigned long long VersionStore::last_write_ts(std::string_view key) {
+    auto it = write_ts.find(key);
+    return it == write_ts.end() ? 0 : it->second;
+}
+
+// latest write to any key in [low,high), write_ts is unordered so this is a full pass
+unsigned long long VersionStore::last_write_ts(const std::string &low,const std::string &high) {
+    unsigned long long ts = 0;
+    for (auto &[key,key_ts] : write_ts) {
+        if (low <= key && key < high) {
+            ts = std::max(ts,key_ts);
+        }
+    }
+    return ts;
+}